@@ -48,7 +48,7 @@
  * @details Frequency of the system timer that drives the system ticks. This
  *          setting also defines the system tick time unit.
  */
-#define CH_CFG_ST_FREQUENCY                 100000
+#define CH_CFG_ST_FREQUENCY                 10000
 
 /**
  * @brief   Time delta constant for the tick-less mode.
@@ -59,6 +59,13 @@
  *          this value.
  */
 #define CH_CFG_ST_TIMEDELTA                 0
+/* The tickless mode needs a free running counter with a compare alarm in the
+   port, and the Kinetis port only has the periodic SysTick. The PIT channels
+   that could stand in for it are used by pit_timer.c and the backlight fades.
+   The tick is 10000 interrupts per second. While the keyboard is in use, the
+   scans add about 11000 more: 9000 row settle sleeps, 1000 waits for the USB
+   frame and 1000 start of frame interrupts. While suspended, the tick is
+   nearly all of the wakeups, since a matrix scan only adds 9.*/
 
 /** @} */
 
@@ -81,7 +88,7 @@
  * @note    The round robin preemption is not supported in tickless mode and
  *          must be set to zero in that case.
  */
-#define CH_CFG_TIME_QUANTUM                 20
+#define CH_CFG_TIME_QUANTUM                 2
 
 /**
  * @brief   Managed RAM size.
@@ -386,7 +393,12 @@
  *
  * @note    The default is @p FALSE.
  */
+#ifdef THREAD_PROFILER_ENABLE
+/* The stack high water marks of thread_profiler.c are found from the fill.*/
+#define CH_DBG_FILL_THREADS                 TRUE
+#else
 #define CH_DBG_FILL_THREADS                 FALSE
+#endif
 
 /**
  * @brief   Debug option, threads profiling.
@@ -412,8 +424,14 @@
  * @brief   Threads descriptor structure extension.
  * @details User fields added to the end of the @p thread_t structure.
  */
+#ifdef THREAD_PROFILER_ENABLE
+#define CH_CFG_THREAD_EXTRA_FIELDS                                          \
+  /* CPU cycles spent in the thread, see thread_profiler.c.*/               \
+  uint64_t profile_cycles;
+#else
 #define CH_CFG_THREAD_EXTRA_FIELDS                                          \
   /* Add threads custom fields here.*/
+#endif
 
 /**
  * @brief   Threads initialization hook.
@@ -422,9 +440,15 @@
  * @note    It is invoked from within @p chThdInit() and implicitly from all
  *          the threads creation APIs.
  */
+#ifdef THREAD_PROFILER_ENABLE
+#define CH_CFG_THREAD_INIT_HOOK(tp) {                                       \
+  (tp)->profile_cycles = 0;                                                 \
+}
+#else
 #define CH_CFG_THREAD_INIT_HOOK(tp) {                                       \
   /* Add threads initialization code here.*/                                \
 }
+#endif
 
 /**
  * @brief   Threads finalization hook.
@@ -442,23 +466,54 @@
  * @brief   Context switch hook.
  * @details This hook is invoked just before switching between threads.
  */
+#ifdef THREAD_PROFILER_ENABLE
+#define CH_CFG_CONTEXT_SWITCH_HOOK(ntp, otp) {                              \
+  thread_profiler_switch(otp);                                              \
+}
+#else
 #define CH_CFG_CONTEXT_SWITCH_HOOK(ntp, otp) {                              \
   /* Context switch code here.*/                                            \
 }
+#endif
+
+/*
+ * The IRQ hooks run on every interrupt, including the system tick, so they
+ * are kept inline. Only the outermost interrupt is timed.
+ */
+#ifdef THREAD_PROFILER_ENABLE
+#define THREAD_PROFILER_CYCCNT (*(volatile uint32_t *)0xE0001004)
+#endif
 
 /**
  * @brief   ISR enter hook.
  */
+#ifdef THREAD_PROFILER_ENABLE
+#define CH_CFG_IRQ_PROLOGUE_HOOK() {                                        \
+  if (thread_profiler_irq_nesting++ == 0) {                                 \
+    thread_profiler_irq_start = THREAD_PROFILER_CYCCNT;                     \
+  }                                                                         \
+}
+#else
 #define CH_CFG_IRQ_PROLOGUE_HOOK() {                                        \
   /* IRQ prologue code here.*/                                              \
 }
+#endif
 
 /**
  * @brief   ISR exit hook.
  */
+#ifdef THREAD_PROFILER_ENABLE
+#define CH_CFG_IRQ_EPILOGUE_HOOK() {                                        \
+  if (--thread_profiler_irq_nesting == 0) {                                 \
+    thread_profiler_irq_cycles +=                                           \
+        THREAD_PROFILER_CYCCNT - thread_profiler_irq_start;                 \
+  }                                                                         \
+}
+#else
 #define CH_CFG_IRQ_EPILOGUE_HOOK() {                                        \
   /* IRQ epilogue code here.*/                                              \
 }
+#endif
 
 /**
  * @brief   Idle thread enter hook.
@@ -519,6 +574,21 @@
 /* Port-specific settings (override port settings defaulted in chcore.h).    */
 /*===========================================================================*/
 
+/* The idle thread waits for the next interrupt with the core clock stopped.
+   The Kinetis port only has the periodic tick, so the tick frequency above is
+   kept low, and short delays use the PIT instead, see pit_timer.h.*/
+#define CORTEX_ENABLE_WFI_IDLE              TRUE
+
+#if defined(THREAD_PROFILER_ENABLE) && !defined(_FROM_ASM_)
+/* Used by the hooks above, defined in thread_profiler.c.*/
+#include <stdint.h>
+struct ch_thread;
+extern volatile uint32_t thread_profiler_irq_nesting;
+extern volatile uint32_t thread_profiler_irq_start;
+extern volatile uint32_t thread_profiler_irq_cycles;
+void thread_profiler_switch(struct ch_thread *otp);
+#endif
+
 #endif  /* _CHCONF_H_ */
 
 /** @} */
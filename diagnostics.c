@@ -0,0 +1,177 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "diagnostics.h"
+#include "serial_link/system/serial_link.h"
+
+// The maxima are kept separately for each consumer, so that sampling doesn't
+// reset them for the others
+typedef struct {
+    systime_t max_latency;
+    systime_t max_link_gap;
+    uint32_t last_scan_count;
+    uint32_t last_link_count;
+    systime_t last_sample_time;
+} consumer_state_t;
+
+// Everything except the sampling is only touched by the keyboard thread. The
+// sampling doesn't lock, so a maximum that is updated at the same time can end
+// up in the next sample instead, which doesn't matter for the graph.
+static uint32_t scan_count = 0;
+static bool change_pending = false;
+static bool change_processed = false;
+static systime_t change_time;
+static bool link_updated = false;
+static systime_t last_link_update;
+static uint32_t link_count = 0;
+
+static consumer_state_t consumers[DIAGNOSTICS_CONSUMERS];
+static volatile bool graph_enabled = false;
+
+static host_driver_t* wrapped_driver = NULL;
+
+#define TICKS_TO_US(n) ((uint32_t)((uint64_t)(n) * 1000000 / CH_CFG_ST_FREQUENCY))
+
+void diagnostics_scan(void) {
+    scan_count++;
+}
+
+// The latency is measured from the first change, so it includes the debounce
+// time of the local keys
+void diagnostics_key_change(void) {
+    if (!change_pending) {
+        change_pending = true;
+        change_time = chVTGetSystemTimeX();
+    }
+}
+
+void diagnostics_link_update(void) {
+    systime_t now = chVTGetSystemTimeX();
+    if (link_updated) {
+        systime_t gap = now - last_link_update;
+        for (int i = 0; i < DIAGNOSTICS_CONSUMERS; i++) {
+            if (gap > consumers[i].max_link_gap) {
+                consumers[i].max_link_gap = gap;
+            }
+        }
+    }
+    last_link_update = now;
+    link_updated = true;
+    link_count++;
+}
+
+void diagnostics_matrix_change(void) {
+    if (change_pending) {
+        change_processed = true;
+    }
+}
+
+// A change that didn't cause a report, like a layer key, isn't measured
+void diagnostics_loop_end(void) {
+    if (change_processed) {
+        change_pending = false;
+        change_processed = false;
+    }
+}
+
+static void report_sent(void) {
+    if (change_processed) {
+        systime_t latency = chVTGetSystemTimeX() - change_time;
+        for (int i = 0; i < DIAGNOSTICS_CONSUMERS; i++) {
+            if (latency > consumers[i].max_latency) {
+                consumers[i].max_latency = latency;
+            }
+        }
+        change_pending = false;
+        change_processed = false;
+    }
+}
+
+static uint8_t keyboard_leds(void) {
+    return wrapped_driver->keyboard_leds();
+}
+
+static void send_keyboard(report_keyboard_t* report) {
+    wrapped_driver->send_keyboard(report);
+    report_sent();
+}
+
+static void send_mouse(report_mouse_t* report) {
+    wrapped_driver->send_mouse(report);
+}
+
+static void send_system(uint16_t data) {
+    wrapped_driver->send_system(data);
+    report_sent();
+}
+
+static void send_consumer(uint16_t data) {
+    wrapped_driver->send_consumer(data);
+    report_sent();
+}
+
+static host_driver_t diagnostics_driver = {
+    keyboard_leds,
+    send_keyboard,
+    send_mouse,
+    send_system,
+    send_consumer,
+};
+
+host_driver_t* diagnostics_wrap_driver(host_driver_t* driver) {
+    wrapped_driver = driver;
+    return &diagnostics_driver;
+}
+
+diagnostics_sample_t diagnostics_sample(diagnostics_consumer_t consumer) {
+    consumer_state_t* c = &consumers[consumer];
+    diagnostics_sample_t sample = {0, 0, 0, 0};
+    systime_t now = chVTGetSystemTimeX();
+    uint32_t count = scan_count;
+    systime_t elapsed = now - c->last_sample_time;
+    if (elapsed > 0) {
+        sample.scans_per_second = (uint64_t)(count - c->last_scan_count) * CH_CFG_ST_FREQUENCY / elapsed;
+    }
+    c->last_scan_count = count;
+    c->last_sample_time = now;
+
+    sample.max_latency_us = TICKS_TO_US(c->max_latency);
+    c->max_latency = 0;
+
+    uint32_t links = link_count;
+    sample.link_updates = links - c->last_link_count;
+    c->last_link_count = links;
+
+    systime_t gap = c->max_link_gap;
+    c->max_link_gap = 0;
+    // A link that has stopped shows as a growing gap
+    if (link_updated && now - last_link_update > gap) {
+        gap = now - last_link_update;
+    }
+    if (is_serial_link_connected()) {
+        sample.max_link_gap_us = TICKS_TO_US(gap);
+    }
+    return sample;
+}
+
+void diagnostics_toggle_graph(void) {
+    graph_enabled = !graph_enabled;
+}
+
+bool diagnostics_graph_enabled(void) {
+    return graph_enabled;
+}
@@ -0,0 +1,67 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DIAGNOSTICS_H_
+#define DIAGNOSTICS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ch.h"
+#include "host_driver.h"
+
+// Collects the scan rate, the key to report latency and the serial link
+// update gaps, for the diagnostics graph of the visualizer and the telemetry.
+// The counters are updated by the keyboard thread, and sampled by each
+// consumer once per second.
+
+typedef enum {
+    DIAGNOSTICS_GRAPH,
+    DIAGNOSTICS_TELEMETRY,
+    DIAGNOSTICS_CONSUMERS,
+} diagnostics_consumer_t;
+
+typedef struct {
+    uint32_t scans_per_second;
+    // The longest time from the first change of a key to the report, in the
+    // last sample period. Zero if no reports were caused by key changes.
+    uint32_t max_latency_us;
+    // The longest time without a matrix update from the other half, zero when
+    // not connected
+    uint32_t max_link_gap_us;
+    // The number of matrix updates received from the other half
+    uint32_t link_updates;
+} diagnostics_sample_t;
+
+// Called by matrix.c
+void diagnostics_scan(void);
+void diagnostics_key_change(void);
+void diagnostics_link_update(void);
+// Called by the keyboard thread when a key change has been processed, and at
+// the end of each loop
+void diagnostics_matrix_change(void);
+void diagnostics_loop_end(void);
+// Returns a host driver that measures the reports sent through the given one
+host_driver_t* diagnostics_wrap_driver(host_driver_t* driver);
+
+// Returns the values since the last call by the same consumer
+diagnostics_sample_t diagnostics_sample(diagnostics_consumer_t consumer);
+
+// The graph is shown instead of the normal LCD animation when enabled
+void diagnostics_toggle_graph(void);
+bool diagnostics_graph_enabled(void);
+
+#endif /* DIAGNOSTICS_H_ */
@@ -34,12 +34,54 @@
     palSetPadMode(ST7565_GPIOPORT, ST7565_##portname##_PIN, portmode)
 
 #define ST7565_SPI_MODE PORTx_PCRn_DSE | PORTx_PCRn_MUX(2)
+
+// A frame is sent to the LCD as a list of segments, each either in command or
+// data mode. The segments are sent by DMA, and the next one is started from
+// the end callback of the previous one, so the visualizer thread doesn't have
+// to wait for the transfer to finish.
+// A full frame needs 4 pages * (commands + data) + the start line command
+#define ST7565_MAX_SEGMENTS 9
+
+// New frames are started at most this often. If the display is flushed several
+// times during the interval, only the latest frame is sent.
+#ifndef ST7565_FRAME_INTERVAL
+#define ST7565_FRAME_INTERVAL MS2ST(33)
+#endif
+
+typedef struct {
+    const uint8_t* buffer;
+    uint16_t length;
+    bool_t data_mode;
+} st7565_segment_t;
+
+static st7565_segment_t st7565_segments[ST7565_MAX_SEGMENTS];
+static unsigned st7565_num_segments = 0;
+static unsigned st7565_next_segment = 0;
+static volatile bool_t st7565_stream_active = FALSE;
+static thread_reference_t st7565_stream_waiter = NULL;
+static thread_reference_t st7565_send_waiter = NULL;
+
+// Called with the system locked when it's time to send the next frame, it
+// should queue all the segments of the frame. Returns FALSE if there's nothing
+// to send.
+typedef bool_t (*st7565_next_frame_func)(GDisplay *g);
+
+static GDisplay* st7565_display = NULL;
+static st7565_next_frame_func st7565_next_frame = NULL;
+static bool_t st7565_bus_acquired = FALSE;
+static bool_t st7565_frame_locked = FALSE;
+static bool_t st7565_frame_ready = FALSE;
+static systime_t st7565_last_frame_time = 0;
+static virtual_timer_t st7565_frame_timer;
+
+static void st7565_stream_end_cb(SPIDriver* spip);
+
 // DSPI Clock and Transfer Attributes
 // Frame Size: 8 bits
 // MSB First
 // CLK Low by default
 static const SPIConfig spi1config = {
-	NULL,
+	st7565_stream_end_cb,
 	/* HW dependent part.*/
 	ST7565_GPIOPORT,
     ST7565_SS_PIN,
@@ -54,6 +96,118 @@ static const SPIConfig spi1config = {
 
 static bool_t st7565_is_data_mode = 1;
 
+// The A0 setup and hold times need to be at least 10 vs 25 ns respectively
+// The delays are busy waits on the cycle counter, ~110 ns at 72 MHz, that's a
+// lot shorter than sleeping for system ticks
+#define ST7565_A0_DELAY_CYCLES 8
+
+// Commands are collected into a buffer and sent as a single transfer,
+// so that A0 only needs to be switched when going between command and data
+#define ST7565_CMD_BUFFER_SIZE 16
+static uint8_t st7565_cmd_buffer[ST7565_CMD_BUFFER_SIZE];
+static unsigned st7565_cmd_length = 0;
+
+static void st7565_set_a0(bool_t data_mode) {
+    if (data_mode) {
+        palSetPad(ST7565_GPIOPORT, ST7565_A0_PIN);
+    }
+    else {
+        palClearPad(ST7565_GPIOPORT, ST7565_A0_PIN);
+    }
+    st7565_is_data_mode = data_mode;
+}
+
+static void st7565_switch_mode(bool_t data_mode) {
+    chSysPolledDelayX(ST7565_A0_DELAY_CYCLES);
+    st7565_set_a0(data_mode);
+    chSysPolledDelayX(ST7565_A0_DELAY_CYCLES);
+}
+
+// The SPI config has an end callback for the streaming, and spiSend can't be
+// used together with one, so the direct transfers are started the same way
+// as the stream, and wait for the end callback instead
+static void st7565_send(size_t length, const uint8_t* buffer) {
+    chSysLock();
+    spiStartSendI(&SPID1, length, buffer);
+    chThdSuspendS(&st7565_send_waiter);
+    chSysUnlock();
+}
+
+static void st7565_send_cmds(void) {
+    if (st7565_cmd_length == 0) {
+        return;
+    }
+    if (st7565_is_data_mode) {
+        st7565_switch_mode(FALSE);
+    }
+    st7565_send(st7565_cmd_length, st7565_cmd_buffer);
+    st7565_cmd_length = 0;
+}
+
+// Must be called with the system locked
+static void st7565_start_next_segment(void) {
+    const st7565_segment_t* segment = &st7565_segments[st7565_next_segment++];
+    if (segment->data_mode != st7565_is_data_mode) {
+        // No delays needed here, the previous transfer is completely done
+        // when the end callback is called, and the CS to clock delay
+        // configured in the CTAR register is longer than the A0 setup time
+        st7565_set_a0(segment->data_mode);
+    }
+    spiStartSendI(&SPID1, segment->length, segment->buffer);
+}
+
+static void st7565_frame_timer_cb(void* arg);
+
+// Starts sending the next frame, if there's one ready, the bus is free and
+// enough time has passed since the previous frame.
+// Must be called with the system locked
+static void st7565_present_i(void) {
+    if (!st7565_frame_ready || st7565_frame_locked ||
+            st7565_bus_acquired || st7565_stream_active) {
+        return;
+    }
+    systime_t elapsed = chVTTimeElapsedSinceX(st7565_last_frame_time);
+    if (elapsed < ST7565_FRAME_INTERVAL) {
+        if (!chVTIsArmedI(&st7565_frame_timer)) {
+            chVTSetI(&st7565_frame_timer, ST7565_FRAME_INTERVAL - elapsed, st7565_frame_timer_cb, NULL);
+        }
+        return;
+    }
+    st7565_frame_ready = FALSE;
+    if (!st7565_next_frame(st7565_display) || st7565_num_segments == 0) {
+        return;
+    }
+    st7565_last_frame_time = chVTGetSystemTimeX();
+    st7565_stream_active = TRUE;
+    st7565_next_segment = 0;
+    st7565_start_next_segment();
+}
+
+static void st7565_frame_timer_cb(void* arg) {
+    (void) arg;
+    chSysLockFromISR();
+    st7565_present_i();
+    chSysUnlockFromISR();
+}
+
+static void st7565_stream_end_cb(SPIDriver* spip) {
+    (void) spip;
+    chSysLockFromISR();
+    if (!st7565_stream_active) {
+        // A direct transfer from st7565_send
+        chThdResumeI(&st7565_send_waiter, MSG_OK);
+    }
+    else if (st7565_next_segment < st7565_num_segments) {
+        st7565_start_next_segment();
+    }
+    else {
+        st7565_stream_active = FALSE;
+        chThdResumeI(&st7565_stream_waiter, MSG_OK);
+        st7565_present_i();
+    }
+    chSysUnlockFromISR();
+}
+
 static GFXINLINE void init_board(GDisplay *g) {
     (void) g;
     palSetPadModeNamed(A0, PAL_MODE_OUTPUT_PUSHPULL);
@@ -88,40 +242,91 @@ static GFXINLINE void acquire_bus(GDisplay *g) {
     (void) g;
     // Only the LCD is using the SPI bus, so no need to acquire
     // spiAcquireBus(&SPID1);
+    // But the previous frame might still be streaming out, and no new
+    // frames can be started until the bus is released again
+    chSysLock();
+    st7565_bus_acquired = TRUE;
+    if (st7565_stream_active) {
+        chThdSuspendS(&st7565_stream_waiter);
+    }
+    chSysUnlock();
 }
 
 static GFXINLINE void release_bus(GDisplay *g) {
     (void) g;
+    // Send the commands that are still waiting in the buffer
+    st7565_send_cmds();
     // Only the LCD is using the SPI bus, so no need to release
     //spiReleaseBus(&SPID1);
+    chSysLock();
+    st7565_bus_acquired = FALSE;
+    st7565_present_i();
+    chSysUnlock();
 }
 
+// The command is only buffered, it's sent together with the following commands
+// when data is written, the bus is released or flush_cmd is called
 static GFXINLINE void write_cmd(GDisplay *g, uint8_t cmd) {
 	(void) g;
-	if (st7565_is_data_mode) {
-	    // The sleeps need to be at lest 10 vs 25 ns respectively
-	    // So let's sleep two ticks, one tick might not be enough
-	    // if we are at the end of the tick
-	    chThdSleep(2);
-        palClearPad(ST7565_GPIOPORT, ST7565_A0_PIN);
-        chThdSleep(2);
-        st7565_is_data_mode = 0;
+	if (st7565_cmd_length == ST7565_CMD_BUFFER_SIZE) {
+	    st7565_send_cmds();
 	}
-	spiSend(&SPID1, 1, &cmd);
+	st7565_cmd_buffer[st7565_cmd_length++] = cmd;
+}
+
+static GFXINLINE void flush_cmd(GDisplay *g) {
+	(void) g;
+	st7565_send_cmds();
 }
 
 static GFXINLINE void write_data(GDisplay *g, uint8_t* data, uint16_t length) {
 	(void) g;
+	st7565_send_cmds();
 	if (!st7565_is_data_mode) {
-	    // The sleeps need to be at lest 10 vs 25 ns respectively
-	    // So let's sleep two ticks, one tick might not be enough
-	    // if we are at the end of the tick
-	    chThdSleep(2);
-        palSetPad(ST7565_GPIOPORT, ST7565_A0_PIN);
-	    chThdSleep(2);
-        st7565_is_data_mode = 1;
+	    st7565_switch_mode(TRUE);
 	}
-	spiSend(&SPID1, length, data);
+	st7565_send(length, data);
+}
+
+static GFXINLINE void init_presenter(GDisplay *g, st7565_next_frame_func next_frame) {
+    chVTObjectInit(&st7565_frame_timer);
+    st7565_display = g;
+    st7565_next_frame = next_frame;
+}
+
+// Prevents the next frame from being started while it's being written
+static GFXINLINE void begin_frame(GDisplay *g) {
+    (void) g;
+    chSysLock();
+    st7565_frame_locked = TRUE;
+    chSysUnlock();
+}
+
+// Marks the next frame as ready, it's sent as soon as the bus is free and
+// the frame interval has passed
+static GFXINLINE void end_frame(GDisplay *g) {
+    (void) g;
+    chSysLock();
+    st7565_frame_locked = FALSE;
+    st7565_frame_ready = TRUE;
+    st7565_present_i();
+    chSysUnlock();
+}
+
+// The buffers have to stay untouched until the stream is finished
+// Should only be called from the next frame function
+static GFXINLINE void queue_stream(GDisplay *g, const uint8_t* buffer, uint16_t length, bool_t data_mode) {
+    (void) g;
+    st7565_segment_t* segment = &st7565_segments[st7565_num_segments++];
+    segment->buffer = buffer;
+    segment->length = length;
+    segment->data_mode = data_mode;
+}
+
+// Clears the queue, should only be called from the next frame function
+static GFXINLINE void reset_stream(GDisplay *g) {
+    (void) g;
+    st7565_num_segments = 0;
 }
 
 #endif /* _GDISP_LLD_BOARD_H */
@@ -0,0 +1,123 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#ifndef _GDISP_LLD_BOARD_H
+#define _GDISP_LLD_BOARD_H
+
+/*
+ * Host version of board_ST7565.h, instead of driving the SPI bus, every
+ * transfer is passed to the emulated controller. The commands are batched the
+ * same way as on the real board, so that the statistics match.
+ */
+
+#include "st7565_emulator.h"
+
+#define ST7565_LCD_BIAS         ST7565_LCD_BIAS_9 // actually 6
+#define ST7565_ADC              ST7565_ADC_NORMAL
+#define ST7565_COM_SCAN         ST7565_COM_SCAN_DEC
+#define ST7565_PAGE_ORDER       0,1,2,3
+
+#define ST7565_MAX_SEGMENTS 9
+#define ST7565_CMD_BUFFER_SIZE 16
+
+typedef struct {
+    const uint8_t* buffer;
+    uint16_t length;
+    bool_t data_mode;
+} st7565_segment_t;
+
+typedef bool_t (*st7565_next_frame_func)(GDisplay *g);
+
+static st7565_next_frame_func st7565_next_frame = NULL;
+static st7565_segment_t st7565_segments[ST7565_MAX_SEGMENTS];
+static unsigned st7565_num_segments = 0;
+static uint8_t st7565_cmd_buffer[ST7565_CMD_BUFFER_SIZE];
+static unsigned st7565_cmd_length = 0;
+
+static void st7565_send_cmds(void) {
+    if (st7565_cmd_length == 0) {
+        return;
+    }
+    st7565_emulator_transfer(st7565_cmd_buffer, st7565_cmd_length, false);
+    st7565_cmd_length = 0;
+}
+
+static GFXINLINE void init_board(GDisplay *g) {
+    (void) g;
+    st7565_emulator_reset();
+}
+
+static GFXINLINE void post_init_board(GDisplay *g) {
+    (void) g;
+}
+
+static GFXINLINE void setpin_reset(GDisplay *g, bool_t state) {
+    (void) g;
+    (void) state;
+}
+
+static GFXINLINE void acquire_bus(GDisplay *g) {
+    (void) g;
+}
+
+static GFXINLINE void release_bus(GDisplay *g) {
+    (void) g;
+    st7565_send_cmds();
+}
+
+static GFXINLINE void write_cmd(GDisplay *g, uint8_t cmd) {
+    (void) g;
+    if (st7565_cmd_length == ST7565_CMD_BUFFER_SIZE) {
+        st7565_send_cmds();
+    }
+    st7565_cmd_buffer[st7565_cmd_length++] = cmd;
+}
+
+static GFXINLINE void flush_cmd(GDisplay *g) {
+    (void) g;
+    st7565_send_cmds();
+}
+
+static GFXINLINE void write_data(GDisplay *g, uint8_t* data, uint16_t length) {
+    (void) g;
+    st7565_send_cmds();
+    st7565_emulator_transfer(data, length, true);
+}
+
+static GFXINLINE void init_presenter(GDisplay *g, st7565_next_frame_func next_frame) {
+    (void) g;
+    st7565_next_frame = next_frame;
+}
+
+static GFXINLINE void begin_frame(GDisplay *g) {
+    (void) g;
+}
+
+// There's no frame pacing on the host, the frame is sent immediately
+static GFXINLINE void end_frame(GDisplay *g) {
+    if (!st7565_next_frame(g)) {
+        return;
+    }
+    for (unsigned i = 0; i < st7565_num_segments; i++) {
+        st7565_emulator_transfer(st7565_segments[i].buffer, st7565_segments[i].length, st7565_segments[i].data_mode);
+    }
+}
+
+static GFXINLINE void queue_stream(GDisplay *g, const uint8_t* buffer, uint16_t length, bool_t data_mode) {
+    (void) g;
+    st7565_segment_t* segment = &st7565_segments[st7565_num_segments++];
+    segment->buffer = buffer;
+    segment->length = length;
+    segment->data_mode = data_mode;
+}
+
+static GFXINLINE void reset_stream(GDisplay *g) {
+    (void) g;
+    st7565_num_segments = 0;
+}
+
+#endif /* _GDISP_LLD_BOARD_H */
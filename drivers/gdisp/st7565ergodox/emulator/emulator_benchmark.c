@@ -0,0 +1,355 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "gfx.h"
+#include "emulator_benchmark.h"
+#include "drivers/gdisp/st7565ergodox/st7565ergodox.h"
+#include "src/gdisp/mcufont/mcufont.h"
+
+// The references draw into their own frame, in the same page format as the
+// driver
+#define SCREEN_WIDTH        128
+#define SCREEN_HEIGHT       32
+#define xyaddr(x, y)        ((x) + ((y)>>3)*SCREEN_WIDTH)
+#define xybit(y)            (1<<((y)&7))
+
+#define BITMAP_WIDTH        128
+#define BITMAP_HEIGHT       32
+#define BLIT_ITERATIONS     20000
+#define TEXT_ITERATIONS     2000
+
+typedef struct {
+    const char* name;
+    coord_t x;
+    coord_t y;
+    coord_t cx;
+    coord_t cy;
+    coord_t srcx;
+    coord_t srcy;
+} blit_case_t;
+
+static const blit_case_t blit_cases[] = {
+    {"blit full screen", 0, 0, 128, 32, 0, 0},
+    {"blit layer bitmap", 0, 0, 64, 2, 0, 0},
+    {"blit 16x16 icon", 8, 8, 16, 16, 0, 0},
+    {"blit unaligned", 3, 5, 100, 20, 1, 2},
+    {"blit ragged edge", 5, 3, 21, 13, 8, 4},
+};
+
+typedef struct {
+    const char* name;
+    const char* font;
+    const char* str;
+    coord_t x;
+    coord_t y;
+} text_case_t;
+
+static const text_case_t text_cases[] = {
+    {"dejavu", "DejaVuSansBold12", "Function keys", 0, 10},
+    {"fixed", "fixed_5x8", "fixed 5x8", 0, 20},
+};
+
+typedef struct {
+    const char* name;
+    orientation_t orientation;
+} orientation_case_t;
+
+static const orientation_case_t orientation_cases[] = {
+    {"0", GDISP_ROTATE_0},
+    {"90", GDISP_ROTATE_90},
+    {"180", GDISP_ROTATE_180},
+    {"270", GDISP_ROTATE_270},
+};
+
+// The state of the reference text drawing. Like with uGFX, the parameters of
+// each drawing call are passed in p, and the text is clipped to the string and
+// the screen.
+typedef struct {
+    struct {
+        coord_t x;
+        coord_t y;
+        coord_t x1;
+        coord_t cx;
+        coord_t cy;
+        color_t color;
+    } p;
+    orientation_t orientation;
+    uint32_t flags;
+    font_t font;
+    coord_t clipx0;
+    coord_t clipy0;
+    coord_t clipx1;
+    coord_t clipy1;
+} reference_text_t;
+
+static uint8_t bitmap[BITMAP_WIDTH * BITMAP_HEIGHT / 8];
+static uint8_t driver_frame[ST7565_FRAME_SIZE];
+static uint8_t reference_frame[ST7565_FRAME_SIZE];
+
+static double time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Starts both frames from the same cleared screen
+static void clear_frames(void) {
+    gdispClear(Black);
+    gdispControl(GDISP_CONTROL_ST7565_READ_FRAME, driver_frame);
+    memcpy(reference_frame, driver_frame, sizeof(reference_frame));
+}
+
+static bool frames_match(void) {
+    gdispControl(GDISP_CONTROL_ST7565_READ_FRAME, driver_frame);
+    return memcmp(driver_frame, reference_frame, sizeof(reference_frame)) == 0;
+}
+
+static void print_result(const char* name, double driver_ns, double reference_ns, bool match) {
+    printf("%-24s %9.0f ns %9.0f ns %6.1fx%s\n", name, driver_ns, reference_ns,
+        reference_ns / driver_ns, match ? "" : "  MISMATCH");
+}
+
+static void print_header(void) {
+    printf("%-24s %12s %12s %7s\n", "", "driver", "reference", "speedup");
+}
+
+// The per pixel copy of the driver before the 8x8 block transpose
+static void reference_blit(const blit_case_t* c, const uint8_t* buffer) {
+    for (int i = 0; i < c->cy; i++) {
+        unsigned dstx = c->x;
+        unsigned dsty = c->y + i;
+        unsigned srcbit = (c->srcy + i) * BITMAP_WIDTH + c->srcx;
+        for (int j = 0; j < c->cx; j++) {
+            uint8_t src = buffer[srcbit / 8];
+            uint8_t bit = 7 - (srcbit % 8);
+            uint8_t* dst = &reference_frame[xyaddr(dstx, dsty)];
+            if ((src >> bit) & 1) {
+                *dst |= xybit(dsty);
+            }
+            else {
+                *dst &= ~xybit(dsty);
+            }
+            dstx++;
+            srcbit++;
+        }
+    }
+}
+
+static void driver_blit(const blit_case_t* c, const uint8_t* buffer) {
+    gdispBlitAreaEx(c->x, c->y, c->cx, c->cy, c->srcx, c->srcy, BITMAP_WIDTH, (const pixel_t*)buffer);
+}
+
+void benchmark_blit(void) {
+    // Any pattern will do, as long as it's not uniform
+    uint32_t seed = 1;
+    for (unsigned i = 0; i < sizeof(bitmap); i++) {
+        seed = seed * 1103515245 + 12345;
+        bitmap[i] = seed >> 16;
+    }
+
+    print_header();
+    for (unsigned i = 0; i < sizeof(blit_cases) / sizeof(blit_cases[0]); i++) {
+        const blit_case_t* c = &blit_cases[i];
+
+        clear_frames();
+        driver_blit(c, bitmap);
+        reference_blit(c, bitmap);
+        bool match = frames_match();
+
+        double start = time_ns();
+        for (unsigned n = 0; n < BLIT_ITERATIONS; n++) {
+            driver_blit(c, bitmap);
+        }
+        double driver_ns = (time_ns() - start) / BLIT_ITERATIONS;
+
+        start = time_ns();
+        for (unsigned n = 0; n < BLIT_ITERATIONS; n++) {
+            reference_blit(c, bitmap);
+        }
+        double reference_ns = (time_ns() - start) / BLIT_ITERATIONS;
+
+        print_result(c->name, driver_ns, reference_ns, match);
+    }
+}
+
+// The same pixel drawing as the driver, which checks the orientation for
+// every pixel
+static void __attribute__((noinline)) reference_draw_pixel(reference_text_t* t) {
+    coord_t x, y;
+    switch(t->orientation) {
+    default:
+    case GDISP_ROTATE_0:
+        x = t->p.x;
+        y = t->p.y;
+        break;
+    case GDISP_ROTATE_90:
+        x = t->p.y;
+        y = SCREEN_HEIGHT-1 - t->p.x;
+        break;
+    case GDISP_ROTATE_180:
+        x = SCREEN_WIDTH-1 - t->p.x;
+        y = SCREEN_HEIGHT-1 - t->p.y;
+        break;
+    case GDISP_ROTATE_270:
+        x = SCREEN_WIDTH-1 - t->p.y;
+        y = t->p.x;
+        break;
+    }
+    if (gdispColor2Native(t->p.color) != Black)
+        reference_frame[xyaddr(x, y)] |= xybit(y);
+    else
+        reference_frame[xyaddr(x, y)] &= ~xybit(y);
+    t->flags = 1;
+}
+
+// The fill of the driver, which is the same before and after
+static void __attribute__((noinline)) reference_fill_area(reference_text_t* t) {
+    coord_t x, y, cx, cy;
+    switch(t->orientation) {
+    default:
+    case GDISP_ROTATE_0:
+        x = t->p.x;
+        y = t->p.y;
+        cx = t->p.cx;
+        cy = t->p.cy;
+        break;
+    case GDISP_ROTATE_90:
+        x = t->p.y;
+        y = SCREEN_HEIGHT - t->p.x - t->p.cx;
+        cx = t->p.cy;
+        cy = t->p.cx;
+        break;
+    case GDISP_ROTATE_180:
+        x = SCREEN_WIDTH - t->p.x - t->p.cx;
+        y = SCREEN_HEIGHT - t->p.y - t->p.cy;
+        cx = t->p.cx;
+        cy = t->p.cy;
+        break;
+    case GDISP_ROTATE_270:
+        x = SCREEN_WIDTH - t->p.y - t->p.cy;
+        y = t->p.x;
+        cx = t->p.cy;
+        cy = t->p.cx;
+        break;
+    }
+
+    uint8_t fill = gdispColor2Native(t->p.color) != Black ? 0xFF : 0x00;
+    unsigned first_page = y >> 3;
+    unsigned last_page = (y + cy - 1) >> 3;
+    uint8_t* dst = reference_frame + xyaddr(x, y);
+    for (unsigned page = first_page; page <= last_page; page++) {
+        uint8_t mask = 0xFF;
+        if (page == first_page)
+            mask &= 0xFF << (y & 7);
+        if (page == last_page)
+            mask &= 0xFF >> (7 - ((y + cy - 1) & 7));
+        if (mask == 0xFF) {
+            memset(dst, fill, cx);
+        }
+        else if (fill) {
+            for (coord_t i = 0; i < cx; i++)
+                dst[i] |= mask;
+        }
+        else {
+            for (coord_t i = 0; i < cx; i++)
+                dst[i] &= ~mask;
+        }
+        dst += SCREEN_WIDTH;
+    }
+    t->flags = 1;
+}
+
+// Like the uGFX horizontal line, single pixels are drawn as pixels, and the
+// longer lines with the fill
+static void __attribute__((noinline)) reference_hline(reference_text_t* t) {
+    if (t->p.x == t->p.x1) {
+        reference_draw_pixel(t);
+        return;
+    }
+    t->p.cx = t->p.x1 - t->p.x + 1;
+    t->p.cy = 1;
+    reference_fill_area(t);
+}
+
+static void reference_line(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void* state) {
+    reference_text_t* t = (reference_text_t*)state;
+    coord_t x1 = x + count;
+    // Without antialiasing uGFX only draws the fully opaque pixels
+    if (alpha != 255 || y < t->clipy0 || y >= t->clipy1)
+        return;
+    if (x < t->clipx0)
+        x = t->clipx0;
+    if (x1 > t->clipx1)
+        x1 = t->clipx1;
+    if (x >= x1)
+        return;
+    t->p.x = x;
+    t->p.y = y;
+    t->p.x1 = x1 - 1;
+    t->p.color = White;
+    reference_hline(t);
+}
+
+static uint8_t reference_char(int16_t x, int16_t y, mf_char c, void* state) {
+    reference_text_t* t = (reference_text_t*)state;
+    return mf_render_character(t->font, x, y, c, reference_line, state);
+}
+
+// Draws the string through the font renderer the same way as
+// gdispDrawString does
+static void reference_draw_string(const text_case_t* c, font_t font, orientation_t orientation) {
+    bool rotated = orientation == GDISP_ROTATE_90 || orientation == GDISP_ROTATE_270;
+    coord_t width = rotated ? SCREEN_HEIGHT : SCREEN_WIDTH;
+    coord_t height = rotated ? SCREEN_WIDTH : SCREEN_HEIGHT;
+    reference_text_t t = {
+        .orientation = orientation,
+        .font = font,
+        .clipx0 = c->x > 0 ? c->x : 0,
+        .clipy0 = c->y > 0 ? c->y : 0,
+        .clipx1 = width,
+        .clipy1 = c->y + font->height < height ? c->y + font->height : height,
+    };
+    mf_render_aligned(font, c->x + font->baseline_x, c->y, MF_ALIGN_LEFT, c->str, 0, reference_char, &t);
+}
+
+void benchmark_text(void) {
+    print_header();
+    for (unsigned i = 0; i < sizeof(text_cases) / sizeof(text_cases[0]); i++) {
+        const text_case_t* c = &text_cases[i];
+        font_t font = gdispOpenFont(c->font);
+        for (unsigned o = 0; o < sizeof(orientation_cases) / sizeof(orientation_cases[0]); o++) {
+            orientation_t orientation = orientation_cases[o].orientation;
+            char name[64];
+            snprintf(name, sizeof(name), "text %s %s", c->name, orientation_cases[o].name);
+            gdispSetOrientation(orientation);
+
+            clear_frames();
+            gdispDrawString(c->x, c->y, c->str, font, White);
+            reference_draw_string(c, font, orientation);
+            bool match = frames_match();
+
+            double start = time_ns();
+            for (unsigned n = 0; n < TEXT_ITERATIONS; n++) {
+                gdispDrawString(c->x, c->y, c->str, font, White);
+            }
+            double driver_ns = (time_ns() - start) / TEXT_ITERATIONS;
+
+            start = time_ns();
+            for (unsigned n = 0; n < TEXT_ITERATIONS; n++) {
+                reference_draw_string(c, font, orientation);
+            }
+            double reference_ns = (time_ns() - start) / TEXT_ITERATIONS;
+
+            print_result(name, driver_ns, reference_ns, match);
+        }
+        gdispCloseFont(font);
+    }
+    gdispSetOrientation(GDISP_ROTATE_0);
+}
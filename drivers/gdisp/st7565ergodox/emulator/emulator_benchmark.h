@@ -0,0 +1,23 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#ifndef _EMULATOR_BENCHMARK_H
+#define _EMULATOR_BENCHMARK_H
+
+/*
+ * Times the drawing functions of the driver against reference
+ * implementations, and checks that both draw the same pixels. Needs gfxInit
+ * to have been called.
+ */
+
+// Against the old pixel by pixel blit loop
+void benchmark_blit(void);
+// Text drawn pixel by pixel through the uGFX fonts, in every orientation,
+// against mcufont drawing straight into a frame without the uGFX call layers
+void benchmark_text(void);
+
+#endif /* _EMULATOR_BENCHMARK_H */
@@ -0,0 +1,121 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+/*
+ * Renders a couple of test screens through the real ST7565 driver, and writes
+ * what the LCD would show as PBM images, together with the amount of SPI
+ * traffic needed for each flush. With --benchmark, the drawing functions of the
+ * driver are timed instead, see emulator_benchmark.h.
+ *
+ * Usage: st7565_emulator [output prefix]
+ *        st7565_emulator --benchmark
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "gfx.h"
+#include "st7565_emulator.h"
+#include "emulator_benchmark.h"
+#include "drivers/gdisp/st7565ergodox/st7565ergodox.h"
+
+static const char* prefix = "frame";
+static unsigned frame = 0;
+
+// Layer bitmap of a keyboard with layers 0 and 2 active, in the same packed
+// 1bpp format as used by the visualizer
+static const uint8_t layer_bitmap[] = {
+    0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00,
+    0xFF, 0xFF, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0x00,
+};
+
+static void flush_frame(const char* name) {
+    st7565_emulator_reset_stats();
+    gdispFlush();
+    char filename[256];
+    snprintf(filename, sizeof(filename), "%s%03u.pbm", prefix, frame);
+    if (!st7565_emulator_write_pbm(filename)) {
+        fprintf(stderr, "Failed to write %s\n", filename);
+    }
+    printf("%3u %-16s %4u bytes (%3u command) %2u transactions %2u mode switches -> %s\n",
+        frame, name,
+        st7565_emulator.bytes, st7565_emulator.cmd_bytes,
+        st7565_emulator.transactions, st7565_emulator.mode_switches,
+        filename);
+    frame++;
+}
+
+static void draw_string(coord_t x, coord_t y, const char* str, font_t font, color_t color) {
+    st7565_draw_string_t params = {
+        .x = x,
+        .y = y,
+        .str = str,
+        .font = font,
+        .color = color,
+    };
+    gdispControl(GDISP_CONTROL_ST7565_DRAW_STRING, &params);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        gfxInit();
+        benchmark_blit();
+        benchmark_text();
+        return 0;
+    }
+    if (argc > 1) {
+        prefix = argv[1];
+    }
+    gfxInit();
+    font_t dejavu = gdispOpenFont("DejaVuSansBold12");
+    font_t fixed = gdispOpenFont("fixed_5x8");
+
+    gdispClear(White);
+    flush_frame("clear");
+
+    gdispClear(White);
+    draw_string(0, 3, "TMK", dejavu, Black);
+    draw_string(0, 15, "Infinity Ergodox", dejavu, Black);
+    flush_frame("welcome");
+
+    gdispClear(White);
+    gdispDrawString(0, 3, "TMK", dejavu, Black);
+    gdispDrawString(0, 15, "Infinity Ergodox", dejavu, Black);
+    flush_frame("welcome_ugfx");
+
+    gdispClear(White);
+    draw_string(0, 10, "Function keys", dejavu, Black);
+    flush_frame("layer_text");
+
+    gdispClear(White);
+    gdispBlitArea(0, 0, 64, 2, (const pixel_t*)layer_bitmap);
+    draw_string(0, 20, "fixed 5x8", fixed, Black);
+    flush_frame("layer_bitmap");
+
+    gdispClear(White);
+    gdispFillArea(3, 5, 50, 20, Black);
+    gdispDrawLine(100, 0, 100, 31, Black);
+    gdispDrawBox(60, 2, 30, 27, Black);
+    flush_frame("shapes");
+
+    // The shapes right of x = 24 scroll left, with a staircase coming in
+    for (unsigned i = 0; i < 32; i++) {
+        st7565_scroll_column_t column = {
+            .x = 24,
+            .pixels = 0xFFFFFFFF << (31 - i),
+            .color = Black,
+        };
+        gdispControl(GDISP_CONTROL_ST7565_SCROLL_COLUMN, &column);
+    }
+    flush_frame("scroll");
+
+    // Nothing changed, so nothing should be sent
+    flush_frame("no_change");
+
+    gdispCloseFont(dejavu);
+    gdispCloseFont(fixed);
+    return 0;
+}
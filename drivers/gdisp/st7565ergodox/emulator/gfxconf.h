@@ -0,0 +1,28 @@
+/**
+ * This file has a different license to the rest of the uGFX system.
+ * You can copy, modify and distribute this file as you see fit.
+ * You do not need to publish your source modifications to this file.
+ * The only thing you are not permitted to do is to relicense it
+ * under a different license.
+ */
+
+/**
+ * Host configuration for the ST7565 emulator. The GDISP settings should be
+ * kept the same as in the gfxconf.h of the keyboard.
+ */
+
+#ifndef _GFXCONF_H
+#define _GFXCONF_H
+
+#define GFX_USE_OS_LINUX                             TRUE
+
+#define GFX_USE_GDISP                                TRUE
+#define GDISP_DRIVER_LIST                            GDISPVMT_ST7565_ERGODOX
+#define GDISP_NEED_CONTROL                           TRUE
+#define GDISP_NEED_TEXT                              TRUE
+    #define GDISP_NEED_TEXT_KERNING                  TRUE
+    #define GDISP_INCLUDE_FONT_DEJAVUSANSBOLD12      TRUE
+    #define GDISP_INCLUDE_FONT_FIXED_5X8             TRUE
+#define GDISP_NEED_STARTUP_LOGO                      FALSE
+
+#endif /* _GFXCONF_H */
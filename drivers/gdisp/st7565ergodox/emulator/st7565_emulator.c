@@ -0,0 +1,149 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "st7565_emulator.h"
+#include "../st7565.h"
+
+// Commands that are followed by a second command byte
+#define ST7565_STATIC_INDICATOR     0xAC
+#define ST7565_BOOSTER_RATIO        0xF8
+#define ST7565_RMW_END              0xEE
+#define ST7565_RESET                0xE2
+
+st7565_emulator_t st7565_emulator;
+
+void st7565_emulator_reset(void) {
+    memset(&st7565_emulator, 0, sizeof(st7565_emulator));
+    st7565_emulator.data_mode = true;
+}
+
+void st7565_emulator_reset_stats(void) {
+    st7565_emulator.bytes = 0;
+    st7565_emulator.cmd_bytes = 0;
+    st7565_emulator.transactions = 0;
+    st7565_emulator.mode_switches = 0;
+}
+
+static void decode_cmd(uint8_t cmd) {
+    st7565_emulator_t* e = &st7565_emulator;
+    if (e->pending_cmd) {
+        if (e->pending_cmd == ST7565_CONTRAST) {
+            e->contrast = cmd & 0x3F;
+        }
+        e->pending_cmd = 0;
+        return;
+    }
+
+    if ((cmd & 0xF0) == ST7565_COLUMN_LSB) {
+        e->column = (e->column & 0xF0) | (cmd & 0x0F);
+    }
+    else if ((cmd & 0xF0) == ST7565_COLUMN_MSB) {
+        e->column = (e->column & 0x0F) | ((cmd & 0x0F) << 4);
+    }
+    else if ((cmd & 0xC0) == ST7565_START_LINE) {
+        e->start_line = cmd & 0x3F;
+    }
+    else if ((cmd & 0xF0) == ST7565_PAGE) {
+        e->page = cmd & 0x0F;
+    }
+    else {
+        switch (cmd) {
+        case ST7565_CONTRAST:
+        case ST7565_STATIC_INDICATOR:
+        case ST7565_BOOSTER_RATIO:
+            e->pending_cmd = cmd;
+            break;
+        case ST7565_DISPLAY_ON:
+            e->display_on = true;
+            break;
+        case ST7565_DISPLAY_OFF:
+            e->display_on = false;
+            break;
+        case ST7565_INVERT_DISPLAY:
+            e->inverted = true;
+            break;
+        case ST7565_POSITIVE_DISPLAY:
+            e->inverted = false;
+            break;
+        case ST7565_ALLON:
+            e->all_on = true;
+            break;
+        case ST7565_ALLON_NORMAL:
+            e->all_on = false;
+            break;
+        case ST7565_RESET:
+            e->page = 0;
+            e->column = 0;
+            e->start_line = 0;
+            break;
+        default:
+            // The rest only affect the electrical configuration, or like
+            // ST7565_RMW and ST7565_RMW_END don't change how the writes
+            // behave
+            break;
+        }
+    }
+}
+
+static void decode_data(uint8_t data) {
+    st7565_emulator_t* e = &st7565_emulator;
+    if (e->page < ST7565_EMULATOR_PAGES && e->column < ST7565_EMULATOR_COLUMNS) {
+        e->ram[e->page][e->column] = data;
+    }
+    e->column++;
+}
+
+void st7565_emulator_transfer(const uint8_t* data, unsigned length, bool data_mode) {
+    st7565_emulator_t* e = &st7565_emulator;
+    if (data_mode != e->data_mode) {
+        e->mode_switches++;
+        e->data_mode = data_mode;
+    }
+    e->transactions++;
+    e->bytes += length;
+    if (!data_mode) {
+        e->cmd_bytes += length;
+    }
+    for (unsigned i = 0; i < length; i++) {
+        if (data_mode) {
+            decode_data(data[i]);
+        }
+        else {
+            decode_cmd(data[i]);
+        }
+    }
+}
+
+bool st7565_emulator_get_pixel(unsigned x, unsigned y) {
+    st7565_emulator_t* e = &st7565_emulator;
+    if (!e->display_on) {
+        return false;
+    }
+    if (e->all_on) {
+        return true;
+    }
+    unsigned line = (e->start_line + y) % ST7565_EMULATOR_LINES;
+    bool set = (e->ram[line / 8][x] >> (line % 8)) & 1;
+    return e->inverted ? !set : set;
+}
+
+bool st7565_emulator_write_pbm(const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "P1\n%d %d\n", ST7565_EMULATOR_COLUMNS, ST7565_EMULATOR_VISIBLE_LINES);
+    for (unsigned y = 0; y < ST7565_EMULATOR_VISIBLE_LINES; y++) {
+        for (unsigned x = 0; x < ST7565_EMULATOR_COLUMNS; x++) {
+            fputc(st7565_emulator_get_pixel(x, y) ? '1' : '0', f);
+        }
+        fputc('\n', f);
+    }
+    return fclose(f) == 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#ifndef _ST7565_EMULATOR_H
+#define _ST7565_EMULATOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Decodes the command and data stream sent to the LCD into a virtual
+ * controller RAM, the same way as the real ST7565 does.
+ */
+
+#define ST7565_EMULATOR_PAGES       8
+#define ST7565_EMULATOR_COLUMNS     128
+#define ST7565_EMULATOR_LINES       (ST7565_EMULATOR_PAGES * 8)
+// Only 32 of the 64 lines are visible on the Infinity Ergodox LCD
+#define ST7565_EMULATOR_VISIBLE_LINES 32
+
+typedef struct {
+    uint8_t ram[ST7565_EMULATOR_PAGES][ST7565_EMULATOR_COLUMNS];
+    unsigned page;
+    unsigned column;
+    unsigned start_line;
+    unsigned contrast;
+    bool display_on;
+    bool inverted;
+    bool all_on;
+    // The first byte of a two byte command
+    uint8_t pending_cmd;
+    bool data_mode;
+
+    // Statistics, counted since the last st7565_emulator_reset_stats
+    unsigned bytes;
+    unsigned cmd_bytes;
+    unsigned transactions;
+    unsigned mode_switches;
+} st7565_emulator_t;
+
+extern st7565_emulator_t st7565_emulator;
+
+void st7565_emulator_reset(void);
+void st7565_emulator_reset_stats(void);
+// Called by the emulated board for each SPI transfer
+void st7565_emulator_transfer(const uint8_t* data, unsigned length, bool data_mode);
+// Returns the pixel as seen on the screen, taking the start line and
+// inversion into account
+bool st7565_emulator_get_pixel(unsigned x, unsigned y);
+// Writes the visible part of the screen as a plain PBM image
+bool st7565_emulator_write_pbm(const char* filename);
+
+#endif /* _ST7565_EMULATOR_H */
@@ -9,11 +9,17 @@
 
 #if GFX_USE_GDISP
 
+#include <string.h>
+
 #define GDISP_DRIVER_VMT			GDISPVMT_ST7565_ERGODOX
 #include "drivers/gdisp/st7565ergodox/gdisp_lld_config.h"
 #include "src/gdisp/gdisp_driver.h"
 
+#ifdef GDISP_ST7565_EMULATOR
+#include "emulator/board_ST7565_emulator.h"
+#else
 #include "board_ST7565.h"
+#endif
 
 /*===========================================================================*/
 /* Driver local definitions.                                                 */
@@ -35,6 +41,15 @@
 #define GDISP_FLG_NEEDFLUSH			(GDISP_FLG_DRIVER<<0)
 
 #include "drivers/gdisp/st7565ergodox/st7565.h"
+#include "drivers/gdisp/st7565ergodox/st7565ergodox.h"
+
+#if GDISP_SCREEN_HEIGHT * GDISP_SCREEN_WIDTH / 8 != ST7565_FRAME_SIZE
+	#error "ST7565_FRAME_SIZE doesn't match the screen size"
+#endif
+
+#if GDISP_NEED_TEXT
+#include "src/gdisp/mcufont/mcufont.h"
+#endif
 
 /*===========================================================================*/
 /* Driver config defaults for backward compatibility.               	     */
@@ -56,9 +71,20 @@
 /* Driver local functions.                                                   */
 /*===========================================================================*/
 
+#define GDISP_SCREEN_PAGES          (GDISP_SCREEN_HEIGHT / 8)
+#define GDISP_PAGE_COMMANDS         4
+
 typedef struct{
     bool_t buffer2;
     uint8_t ram[GDISP_SCREEN_HEIGHT * GDISP_SCREEN_WIDTH / 8];
+    // The next frame can be drawn into ram while the previous one is still
+    // being sent by DMA from tx_ram. Flushed frames wait in pending_ram until
+    // it's their turn, so the buffers are swapped instead of copied.
+    uint8_t* pending_ram;
+    uint8_t* tx_ram;
+    uint8_t frame_buffers[2][GDISP_SCREEN_HEIGHT * GDISP_SCREEN_WIDTH / 8];
+    uint8_t page_cmds[GDISP_SCREEN_PAGES][GDISP_PAGE_COMMANDS];
+    uint8_t start_line_cmd;
 }PrivData;
 
 // Some common routines and macros
@@ -74,6 +100,38 @@ typedef struct{
 #define xyaddr(x, y)		((x) + ((y)>>3)*GDISP_SCREEN_WIDTH)
 #define xybit(y)			(1<<((y)&7))
 
+#if GDISP_HARDWARE_FLUSH
+/*
+ * Called by the board with the system locked when the bus is free for the
+ * next frame. The frame is written to the half of the controller RAM that is
+ * not currently displayed, and the start line is flipped last, so the new
+ * frame is only shown after it has been completely written.
+ */
+static bool_t next_frame_i(GDisplay *g) {
+	unsigned	p;
+	uint8_t* tx = PRIV(g)->pending_ram;
+	PRIV(g)->pending_ram = PRIV(g)->tx_ram;
+	PRIV(g)->tx_ram = tx;
+
+	reset_stream(g);
+	unsigned dstOffset = (PRIV(g)->buffer2 ? 4 : 0);
+	for (p = 0; p < GDISP_SCREEN_PAGES; p++) {
+		uint8_t* cmds = PRIV(g)->page_cmds[p];
+		cmds[0] = ST7565_PAGE | (p + dstOffset);
+		cmds[1] = ST7565_COLUMN_MSB | 0;
+		cmds[2] = ST7565_COLUMN_LSB | 0;
+		cmds[3] = ST7565_RMW;
+		queue_stream(g, cmds, GDISP_PAGE_COMMANDS, FALSE);
+		queue_stream(g, tx + (p*GDISP_SCREEN_WIDTH), GDISP_SCREEN_WIDTH, TRUE);
+	}
+	unsigned line = (PRIV(g)->buffer2 ? 32 : 0);
+	PRIV(g)->start_line_cmd = ST7565_START_LINE | line;
+	queue_stream(g, &PRIV(g)->start_line_cmd, 1, FALSE);
+	PRIV(g)->buffer2 = !PRIV(g)->buffer2;
+	return TRUE;
+}
+#endif
+
 /*===========================================================================*/
 /* Driver exported functions.                                                */
 /*===========================================================================*/
@@ -89,9 +147,14 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 	// The private area is the display surface.
 	g->priv = gfxAlloc(sizeof(PrivData));
 	PRIV(g)->buffer2 = false;
+	PRIV(g)->pending_ram = PRIV(g)->frame_buffers[0];
+	PRIV(g)->tx_ram = PRIV(g)->frame_buffers[1];
 
 	// Initialise the board interface
 	init_board(g);
+#if GDISP_HARDWARE_FLUSH
+	init_presenter(g, next_frame_i);
+#endif
 
 	// Hardware reset
 	setpin_reset(g, TRUE);
@@ -111,14 +174,17 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 
 	// turn on voltage converter (VC=1, VR=0, VF=0)
 	write_cmd(g, ST7565_POWER_CONTROL | 0x04);
+	flush_cmd(g);
 	delay_ms(50);
 
 	// turn on voltage regulator (VC=1, VR=1, VF=0)
 	write_cmd(g, ST7565_POWER_CONTROL | 0x06);
+	flush_cmd(g);
 	delay_ms(50);
 
 	// turn on voltage follower (VC=1, VR=1, VF=1)
 	write_cmd(g, ST7565_POWER_CONTROL | 0x07);
+	flush_cmd(g);
 	delay_ms(50);
 
 	write_cmd(g, 0xE2);
@@ -149,25 +215,15 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 
 #if GDISP_HARDWARE_FLUSH
 	LLDSPEC void gdisp_lld_flush(GDisplay *g) {
-		unsigned	p;
-
 		// Don't flush if we don't need it.
 		if (!(g->flags & GDISP_FLG_NEEDFLUSH))
 			return;
 
-		acquire_bus(g);
-		unsigned dstOffset = (PRIV(g)->buffer2 ? 4 : 0);
-		for (p = 0; p < 4; p++) {
-			write_cmd(g, ST7565_PAGE | (p + dstOffset));
-			write_cmd(g, ST7565_COLUMN_MSB | 0);
-			write_cmd(g, ST7565_COLUMN_LSB | 0);
-			write_cmd(g, ST7565_RMW);
-			write_data(g, RAM(g) + (p*GDISP_SCREEN_WIDTH), GDISP_SCREEN_WIDTH);
-		}
-		unsigned line = (PRIV(g)->buffer2 ? 32 : 0);
-        write_cmd(g, ST7565_START_LINE | line);
-        PRIV(g)->buffer2 = !PRIV(g)->buffer2;
-		release_bus(g);
+		// If the previous flush is still waiting to be sent, it's simply
+		// replaced by this one, so that only the latest frame is sent
+		begin_frame(g);
+		memcpy(PRIV(g)->pending_ram, RAM(g), sizeof(PRIV(g)->frame_buffers[0]));
+		end_frame(g);
 
 		g->flags &= ~GDISP_FLG_NEEDFLUSH;
 	}
@@ -192,7 +248,7 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 			y = GDISP_SCREEN_HEIGHT-1 - g->p.y;
 			break;
 		case GDISP_ROTATE_270:
-			x = GDISP_SCREEN_HEIGHT-1 - g->p.y;
+			x = GDISP_SCREEN_WIDTH-1 - g->p.y;
 			y = g->p.x;
 			break;
 		}
@@ -204,6 +260,69 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 	}
 #endif
 
+#if GDISP_HARDWARE_FILLS
+	/*
+	 * Each page is 8 rows high, so only the top and bottom pages of the area
+	 * need masking, the pages in between are filled with memset.
+	 */
+	LLDSPEC void gdisp_lld_fill_area(GDisplay *g) {
+		coord_t		x, y, cx, cy;
+
+		switch(g->g.Orientation) {
+		default:
+		case GDISP_ROTATE_0:
+			x = g->p.x;
+			y = g->p.y;
+			cx = g->p.cx;
+			cy = g->p.cy;
+			break;
+		case GDISP_ROTATE_90:
+			x = g->p.y;
+			y = GDISP_SCREEN_HEIGHT - g->p.x - g->p.cx;
+			cx = g->p.cy;
+			cy = g->p.cx;
+			break;
+		case GDISP_ROTATE_180:
+			x = GDISP_SCREEN_WIDTH - g->p.x - g->p.cx;
+			y = GDISP_SCREEN_HEIGHT - g->p.y - g->p.cy;
+			cx = g->p.cx;
+			cy = g->p.cy;
+			break;
+		case GDISP_ROTATE_270:
+			x = GDISP_SCREEN_WIDTH - g->p.y - g->p.cy;
+			y = g->p.x;
+			cx = g->p.cy;
+			cy = g->p.cx;
+			break;
+		}
+
+		uint8_t fill = gdispColor2Native(g->p.color) != Black ? 0xFF : 0x00;
+		unsigned first_page = y >> 3;
+		unsigned last_page = (y + cy - 1) >> 3;
+		uint8_t* dst = RAM(g) + xyaddr(x, y);
+		for (unsigned page = first_page; page <= last_page; page++) {
+			uint8_t mask = 0xFF;
+			if (page == first_page)
+				mask &= 0xFF << (y & 7);
+			if (page == last_page)
+				mask &= 0xFF >> (7 - ((y + cy - 1) & 7));
+			if (mask == 0xFF) {
+				memset(dst, fill, cx);
+			}
+			else if (fill) {
+				for (coord_t i = 0; i < cx; i++)
+					dst[i] |= mask;
+			}
+			else {
+				for (coord_t i = 0; i < cx; i++)
+					dst[i] &= ~mask;
+			}
+			dst += GDISP_SCREEN_WIDTH;
+		}
+		g->flags |= GDISP_FLG_NEEDFLUSH;
+	}
+#endif
+
 #if GDISP_HARDWARE_PIXELREAD
 	LLDSPEC color_t gdisp_lld_get_pixel_color(GDisplay *g) {
 		coord_t		x, y;
@@ -223,7 +342,7 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 			y = GDISP_SCREEN_HEIGHT-1 - g->p.y;
 			break;
 		case GDISP_ROTATE_270:
-			x = GDISP_SCREEN_HEIGHT-1 - g->p.y;
+			x = GDISP_SCREEN_WIDTH-1 - g->p.y;
 			y = g->p.x;
 			break;
 		}
@@ -231,33 +350,360 @@ LLDSPEC bool_t gdisp_lld_init(GDisplay *g) {
 	}
 #endif
 
+// Copies one row of pixels at a time, used for the columns that don't fill
+// a whole 8 pixel block
+static void blit_pixels(GDisplay *g, const uint8_t* buffer, unsigned srcbit, coord_t dstx, coord_t dsty, coord_t count) {
+    uint8_t* dst = &(RAM(g)[xyaddr(dstx, dsty)]);
+    uint8_t mask = xybit(dsty);
+    for(coord_t j = 0; j < count; j++) {
+        uint8_t src = buffer[srcbit >> 3];
+        uint8_t bit = 7 - (srcbit & 7);
+        if ((src >> bit) & 1) {
+            *dst |= mask;
+        }
+        else {
+            *dst &= ~mask;
+        }
+        dst++;
+        srcbit++;
+    }
+}
+
+// Reads 8 pixels starting from the given bit of the first byte
+static GFXINLINE uint8_t blit_read_byte(const uint8_t* src, unsigned shift) {
+    if (shift == 0)
+        return src[0];
+    return (uint8_t)((src[0] << shift) | (src[1] >> (8 - shift)));
+}
+
+// Reads the next block, when all the rows start at the same bit position.
+// Rows 0 to 3 go into the bytes of lo, from the lowest up, and rows 4 to 7
+// into hi. The rows below the area are left empty.
+static GFXINLINE void blit_read_block(const uint8_t* src, unsigned stride, unsigned shift, unsigned num_rows, uint32_t* lo, uint32_t* hi) {
+    uint32_t l = 0, h = 0;
+    switch (num_rows) {
+    case 8: h |= (uint32_t)blit_read_byte(src + 7 * stride, shift) << 24;   /* Falls through */
+    case 7: h |= (uint32_t)blit_read_byte(src + 6 * stride, shift) << 16;   /* Falls through */
+    case 6: h |= (uint32_t)blit_read_byte(src + 5 * stride, shift) << 8;    /* Falls through */
+    case 5: h |= blit_read_byte(src + 4 * stride, shift);                   /* Falls through */
+    case 4: l |= (uint32_t)blit_read_byte(src + 3 * stride, shift) << 24;   /* Falls through */
+    case 3: l |= (uint32_t)blit_read_byte(src + 2 * stride, shift) << 16;   /* Falls through */
+    case 2: l |= (uint32_t)blit_read_byte(src + 1 * stride, shift) << 8;    /* Falls through */
+    default: l |= blit_read_byte(src, shift);
+    }
+    *lo = l;
+    *hi = h;
+}
+
+// Transposes an 8x8 block of rows, with the leftmost pixel in the highest bit,
+// into 8 columns with the top pixel in the lowest bit, which is the page format
+// of the controller. This is transpose8 from Hacker's Delight. The rows are
+// passed in as read by blit_read_block, and the columns come out in the order
+// they are stored in memory, columns 0 to 3 in lo and 4 to 7 in hi.
+static GFXINLINE void blit_transpose8(uint32_t* lo, uint32_t* hi) {
+    uint32_t x = *hi, y = *lo, t;
+
+    t = (x ^ (x >> 7)) & 0x00AA00AA;  x = x ^ t ^ (t << 7);
+    t = (y ^ (y >> 7)) & 0x00AA00AA;  y = y ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC; x = x ^ t ^ (t << 14);
+    t = (y ^ (y >> 14)) & 0x0000CCCC; y = y ^ t ^ (t << 14);
+    t = (x & 0xF0F0F0F0) | ((y >> 4) & 0x0F0F0F0F);
+    y = ((x << 4) & 0xF0F0F0F0) | (y & 0x0F0F0F0F);
+    x = t;
+
+    // The first column is in the highest byte, and the memory is little endian
+    *lo = __builtin_bswap32(x);
+    *hi = __builtin_bswap32(y);
+}
+
+// Writes the masked bits of 4 columns at once
+static GFXINLINE void blit_store4(uint8_t* dst, uint32_t cols, uint32_t mask) {
+    uint32_t old;
+    memcpy(&old, dst, sizeof(old));
+    old = (old & ~mask) | (cols & mask);
+    memcpy(dst, &old, sizeof(old));
+}
+
+/*
+ * The source is a packed 1bpp bitmap, stored row by row with the leftmost
+ * pixel in the highest bit, while the display memory is stored in pages of 8
+ * rows, with each byte being one column. So the source is copied in blocks of
+ * 8x8 pixels, which are transposed and shifted into place when the
+ * destination is not aligned to a page. The shifts and masks are done for 4
+ * columns at a time, since the bits that are shifted into the neighbouring
+ * column are always masked away. Only the columns at the right edge that
+ * don't fill a whole block are copied pixel by pixel.
+ */
 LLDSPEC void gdisp_lld_blit_area(GDisplay *g) {
-    uint8_t* buffer = (uint8_t*)g->p.ptr;
-    int linelength = g->p.cx;
-    for (int i = 0; i < g->p.cy; i++) {
-        unsigned dstx = g->p.x;
-        unsigned dsty = g->p.y + i;
-        unsigned srcx = g->p.x1;
-        unsigned srcy = g->p.y1 + i;
-        unsigned srcbit = srcy * g->p.x2 + srcx;
-        for(int j=0; j < linelength; j++) {
-            uint8_t src = buffer[srcbit / 8];
-            uint8_t bit = 7-(srcbit % 8);
-            uint8_t bitset = (src >> bit) & 1;
-            uint8_t* dst = &(RAM(g)[xyaddr(dstx, dsty)]);
-            if (bitset) {
-                *dst |= xybit(dsty);
+    const uint8_t* buffer = (const uint8_t*)g->p.ptr;
+    coord_t blocks = g->p.cx / 8;
+    coord_t remaining = g->p.cx - blocks * 8;
+    // When the width of the source is whole bytes, every row starts at the
+    // same bit, and the rows can be read through a pointer
+    bool_t whole_bytes = (g->p.x2 & 7) == 0;
+    unsigned stride = g->p.x2 >> 3;
+
+    for (coord_t i = 0; i < g->p.cy; i += 8) {
+        unsigned num_rows = g->p.cy - i < 8 ? g->p.cy - i : 8;
+        coord_t dsty = g->p.y + i;
+        unsigned shift = dsty & 7;
+        uint8_t rowmask = 0xFF >> (8 - num_rows);
+        // The block is split into two pages if the destination is not aligned
+        uint32_t lomask = (uint8_t)(rowmask << shift) * 0x01010101u;
+        uint32_t himask = shift ? (uint8_t)(rowmask >> (8 - shift)) * 0x01010101u : 0;
+        uint8_t* dst = &(RAM(g)[xyaddr(g->p.x, dsty)]);
+        unsigned srcbit = (g->p.y1 + i) * g->p.x2 + g->p.x1;
+        const uint8_t* src = buffer + (srcbit >> 3);
+
+        for (coord_t b = 0; b < blocks; b++) {
+            uint32_t lo, hi;
+            if (whole_bytes) {
+                blit_read_block(src + b, stride, srcbit & 7, num_rows, &lo, &hi);
+            }
+            else {
+                lo = hi = 0;
+                for (unsigned r = 0; r < num_rows; r++) {
+                    unsigned bit = srcbit + r * g->p.x2 + b * 8;
+                    uint32_t row = blit_read_byte(buffer + (bit >> 3), bit & 7);
+                    if (r < 4)
+                        lo |= row << (r * 8);
+                    else
+                        hi |= row << ((r - 4) * 8);
+                }
+            }
+            blit_transpose8(&lo, &hi);
+            blit_store4(dst, lo << shift, lomask);
+            blit_store4(dst + 4, hi << shift, lomask);
+            if (himask) {
+                blit_store4(dst + GDISP_SCREEN_WIDTH, lo >> (8 - shift), himask);
+                blit_store4(dst + GDISP_SCREEN_WIDTH + 4, hi >> (8 - shift), himask);
+            }
+            dst += 8;
+        }
+
+        if (remaining) {
+            for (unsigned r = 0; r < num_rows; r++) {
+                blit_pixels(g, buffer, srcbit + r * g->p.x2 + blocks * 8, g->p.x + blocks * 8, dsty + r, remaining);
+            }
+        }
+    }
+    g->flags |= GDISP_FLG_NEEDFLUSH;
+}
+
+#if GDISP_NEED_TEXT && GDISP_NEED_CONTROL && GDISP_HARDWARE_CONTROL
+/*
+ * Decoding the uGFX fonts is slow, so the glyphs are rasterized on first use
+ * into the same page format that the display uses. Drawing a cached string
+ * then only needs a couple of shifts and masks per column.
+ *
+ * The cache is direct mapped, and the glyph data is allocated from a pool,
+ * which is simply cleared together with the cache when it runs out.
+ */
+#define GLYPH_CACHE_SIZE        64
+#define GLYPH_POOL_SIZE         2048
+#define KERNING_CACHE_SIZE      32
+
+typedef struct {
+    font_t font;
+    mf_char character;
+    uint8_t width;
+    uint8_t advance;
+    uint16_t offset;
+} glyph_t;
+
+typedef struct {
+    font_t font;
+    mf_char first;
+    mf_char second;
+    int8_t adjust;
+} kerning_t;
+
+typedef struct {
+    uint8_t* data;
+    uint8_t width;
+    uint8_t height;
+    uint8_t used_width;
+} glyph_raster_t;
+
+static glyph_t glyph_cache[GLYPH_CACHE_SIZE];
+static uint8_t glyph_pool[GLYPH_POOL_SIZE];
+static uint16_t glyph_pool_used = 0;
+#if GDISP_NEED_TEXT_KERNING
+static kerning_t kerning_cache[KERNING_CACHE_SIZE];
+#endif
+
+static GFXINLINE unsigned glyph_hash(font_t font, mf_char c) {
+    return ((uintptr_t)font >> 2) ^ (c * 7);
+}
+
+static void glyph_raster_callback(int16_t x, int16_t y, uint8_t count, uint8_t alpha, void *state) {
+    glyph_raster_t* raster = (glyph_raster_t*)state;
+    // Without antialiasing uGFX only draws the fully opaque pixels
+    if (alpha != 255 || y < 0 || y >= raster->height)
+        return;
+    for (; count; count--, x++) {
+        if (x < 0 || x >= raster->width)
+            continue;
+        raster->data[(y >> 3) * raster->width + x] |= xybit(y);
+        if (x >= raster->used_width)
+            raster->used_width = x + 1;
+    }
+}
+
+static const glyph_t* glyph_get(font_t font, mf_char c) {
+    glyph_t* glyph = &glyph_cache[glyph_hash(font, c) % GLYPH_CACHE_SIZE];
+    if (glyph->font == font && glyph->character == c)
+        return glyph;
+
+    unsigned pages = (font->height + 7) / 8;
+    unsigned size = pages * font->width;
+    if (glyph_pool_used + size > GLYPH_POOL_SIZE) {
+        memset(glyph_cache, 0, sizeof(glyph_cache));
+        glyph_pool_used = 0;
+    }
+
+    glyph_raster_t raster;
+    raster.data = &glyph_pool[glyph_pool_used];
+    raster.width = font->width;
+    raster.height = font->height;
+    raster.used_width = 0;
+    memset(raster.data, 0, size);
+    glyph->advance = mf_render_character(font, 0, 0, c, glyph_raster_callback, &raster);
+
+    // Pack the pages tightly, without the unused columns on the right
+    if (raster.used_width < raster.width) {
+        for (unsigned p = 1; p < pages; p++)
+            memmove(raster.data + p * raster.used_width, raster.data + p * raster.width, raster.used_width);
+    }
+    glyph->font = font;
+    glyph->character = c;
+    glyph->width = raster.used_width;
+    glyph->offset = glyph_pool_used;
+    glyph_pool_used += pages * raster.used_width;
+    return glyph;
+}
+
+#if GDISP_NEED_TEXT_KERNING
+static int8_t glyph_kerning(font_t font, mf_char first, mf_char second) {
+    kerning_t* kerning = &kerning_cache[(glyph_hash(font, first) ^ (second * 13)) % KERNING_CACHE_SIZE];
+    if (kerning->font != font || kerning->first != first || kerning->second != second) {
+        kerning->font = font;
+        kerning->first = first;
+        kerning->second = second;
+        kerning->adjust = mf_compute_kerning(font, first, second);
+    }
+    return kerning->adjust;
+}
+#endif
+
+static void glyph_draw(GDisplay *g, font_t font, const glyph_t* glyph, coord_t x, coord_t y, color_t color) {
+    const uint8_t* data = &glyph_pool[glyph->offset];
+    unsigned pages = (font->height + 7) / 8;
+    bool_t set = gdispColor2Native(color) != Black;
+#if GDISP_NEED_CLIP
+    coord_t clipx0 = g->clipx0, clipy0 = g->clipy0, clipx1 = g->clipx1, clipy1 = g->clipy1;
+#else
+    coord_t clipx0 = 0, clipy0 = 0, clipx1 = g->g.Width, clipy1 = g->g.Height;
+#endif
+    if (y + font->height < clipy1)
+        clipy1 = y + font->height;
+
+    for (unsigned p = 0; p < pages; p++, data += glyph->width) {
+        coord_t dy = y + p * 8;
+        uint8_t rowmask = 0;
+        for (unsigned r = 0; r < 8; r++) {
+            if (dy + (coord_t)r >= clipy0 && dy + (coord_t)r < clipy1)
+                rowmask |= 1 << r;
+        }
+        if (!rowmask)
+            continue;
+
+        for (coord_t c = 0; c < glyph->width; c++) {
+            coord_t dx = x + c;
+            uint8_t bits = data[c] & rowmask;
+            if (dx < clipx0 || dx >= clipx1 || !bits)
+                continue;
+
+            if (g->g.Orientation != GDISP_ROTATE_0) {
+                // The cached data is in the wrong orientation, so draw it
+                // pixel by pixel
+                g->p.color = color;
+                for (unsigned r = 0; r < 8; r++) {
+                    if (bits & (1 << r)) {
+                        g->p.x = dx;
+                        g->p.y = dy + r;
+                        gdisp_lld_draw_pixel(g);
+                    }
+                }
+                continue;
+            }
+
+            uint8_t* dst;
+            uint8_t lo, hi = 0;
+            if (dy < 0) {
+                dst = &RAM(g)[dx];
+                lo = bits >> -dy;
             }
             else {
-                *dst &= ~xybit(dsty);
+                dst = &RAM(g)[xyaddr(dx, dy)];
+                lo = (uint8_t)(bits << (dy & 7));
+                if (dy & 7)
+                    hi = bits >> (8 - (dy & 7));
+            }
+            if (set) {
+                dst[0] |= lo;
+                if (hi)
+                    dst[GDISP_SCREEN_WIDTH] |= hi;
+            }
+            else {
+                dst[0] &= ~lo;
+                if (hi)
+                    dst[GDISP_SCREEN_WIDTH] &= ~hi;
             }
-			dstx++;
-            srcbit++;
         }
     }
+    g->flags |= GDISP_FLG_NEEDFLUSH;
 }
 
+// Lays out the string the same way as gdispDrawString does, which passes
+// x + baseline_x to mcufont, and mcufont starts the first glyph at
+// x0 - baseline_x for left justified text
+static void glyph_draw_string(GDisplay *g, const st7565_draw_string_t* params) {
+    mf_str str = params->str;
+    coord_t x0 = params->x + params->font->baseline_x;
+    coord_t x = x0 - params->font->baseline_x;
+    mf_char prev = 0;
+    mf_char c;
+    while ((c = mf_getchar(&str)) != 0) {
+#if GDISP_NEED_TEXT_KERNING
+        if (prev != 0)
+            x += glyph_kerning(params->font, prev, c);
+#endif
+        const glyph_t* glyph = glyph_get(params->font, c);
+        glyph_draw(g, params->font, glyph, x, params->y, params->color);
+        x += glyph->advance;
+        prev = c;
+    }
+    (void)prev;
+}
+#endif
+
 #if GDISP_NEED_CONTROL && GDISP_HARDWARE_CONTROL
+// Each page is a row of bytes, so the scroll is one move per page
+static void scroll_column(GDisplay *g, const st7565_scroll_column_t* params) {
+	unsigned	p;
+	uint8_t		invert = gdispColor2Native(params->color) != Black ? 0x00 : 0xFF;
+
+	if (params->x < 0 || params->x >= GDISP_SCREEN_WIDTH)
+		return;
+	for (p = 0; p < GDISP_SCREEN_PAGES; p++) {
+		uint8_t* page = RAM(g) + p*GDISP_SCREEN_WIDTH;
+		memmove(page + params->x, page + params->x + 1, GDISP_SCREEN_WIDTH - 1 - params->x);
+		page[GDISP_SCREEN_WIDTH - 1] = (uint8_t)(params->pixels >> (p*8)) ^ invert;
+	}
+	g->flags |= GDISP_FLG_NEEDFLUSH;
+}
+
 	LLDSPEC void gdisp_lld_control(GDisplay *g) {
 		switch(g->p.x) {
 		case GDISP_CONTROL_POWER:
@@ -311,6 +757,27 @@ LLDSPEC void gdisp_lld_blit_area(GDisplay *g) {
 			release_bus(g);
             g->g.Contrast = (unsigned)g->p.ptr;
 			return;
+
+#if GDISP_NEED_TEXT
+		case GDISP_CONTROL_ST7565_DRAW_STRING:
+			glyph_draw_string(g, (const st7565_draw_string_t*)g->p.ptr);
+			return;
+#endif
+
+		case GDISP_CONTROL_ST7565_READ_FRAME:
+			memcpy(g->p.ptr, RAM(g), ST7565_FRAME_SIZE);
+			return;
+
+		case GDISP_CONTROL_ST7565_WRITE_FRAME:
+			if (memcmp(RAM(g), g->p.ptr, ST7565_FRAME_SIZE) == 0)
+				return;
+			memcpy(RAM(g), g->p.ptr, ST7565_FRAME_SIZE);
+			g->flags |= GDISP_FLG_NEEDFLUSH;
+			return;
+
+		case GDISP_CONTROL_ST7565_SCROLL_COLUMN:
+			scroll_column(g, (const st7565_scroll_column_t*)g->p.ptr);
+			return;
 		}
 	}
 #endif // GDISP_NEED_CONTROL
@@ -0,0 +1,59 @@
+/*
+ * This file is subject to the terms of the GFX License. If a copy of
+ * the license was not distributed with this file, you can obtain one at:
+ *
+ *              http://ugfx.org/license.html
+ */
+
+#ifndef _ST7565ERGODOX_H
+#define _ST7565ERGODOX_H
+
+/*
+ * Driver specific controls, used through gdispControl
+ */
+
+/*
+ * Draws a string like gdispDrawString, but from a cache of glyphs that are
+ * already rasterized into the page format of the controller.
+ * The value is a pointer to a st7565_draw_string_t
+ */
+#define GDISP_CONTROL_ST7565_DRAW_STRING    (GDISP_CONTROL_LLD + 0)
+
+/*
+ * Copy the whole drawing buffer out of, or into the driver. The buffer is in
+ * the page format of the controller and independent of the orientation, so it
+ * can only be written back to the same display. Writing only marks the display
+ * for flushing if the contents actually changed.
+ * The value is a pointer to a buffer of ST7565_FRAME_SIZE bytes
+ */
+#define GDISP_CONTROL_ST7565_READ_FRAME     (GDISP_CONTROL_LLD + 1)
+#define GDISP_CONTROL_ST7565_WRITE_FRAME    (GDISP_CONTROL_LLD + 2)
+
+#define ST7565_FRAME_SIZE                   (128 * 32 / 8)
+
+/*
+ * Scrolls the columns to the right of x one step to the left, and draws a new
+ * column at the right edge. Only the drawing buffer is touched, so a scrolling
+ * graph doesn't have to be redrawn. Like the frame functions, this is
+ * independent of the orientation.
+ * The value is a pointer to a st7565_scroll_column_t
+ */
+#define GDISP_CONTROL_ST7565_SCROLL_COLUMN  (GDISP_CONTROL_LLD + 3)
+
+typedef struct {
+    coord_t x;
+    coord_t y;
+    const char* str;
+    font_t font;
+    color_t color;
+} st7565_draw_string_t;
+
+typedef struct {
+    coord_t x;
+    // Bit n is the pixel on line n, the set ones are drawn with color, and the
+    // rest with the other color
+    uint32_t pixels;
+    color_t color;
+} st7565_scroll_column_t;
+
+#endif /* _ST7565ERGODOX_H */
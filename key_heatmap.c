@@ -0,0 +1,259 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "key_heatmap.h"
+#include "hal.h"
+#include "print.h"
+#include "trace.h"
+
+/*
+ * The counts are stored as a log of snapshots in the FlexNVM data flash, which
+ * is separate from the program flash, so the CPU keeps running while it's
+ * erased or programmed. Each snapshot goes into the next free slot, and a
+ * sector is only erased when the log reaches it, which spreads the erases over
+ * all the sectors. The newest valid snapshot is loaded at startup.
+ *
+ * This only works when the FlexNVM hasn't been partitioned for EEPROM
+ * emulation, otherwise the counts are kept in RAM only.
+ */
+
+#define FLASH_SECTOR_SIZE 2048
+#define HEATMAP_SECTORS 8
+#define HEATMAP_FLASH_OFFSET 0
+// The data flash as seen by the CPU, and by the flash commands
+#define DATA_FLASH_BASE 0x10000000
+#define DATA_FLASH_COMMAND_BASE 0x800000
+
+// Partition codes with the whole FlexNVM as data flash, 0xF is the factory
+// default
+#define SIM_FCFG1_DEPART_SHIFT 8
+#define SIM_FCFG1_DEPART_MASK (0xF << SIM_FCFG1_DEPART_SHIFT)
+#define DEPART_ALL_DATA_FLASH 0x0
+#define DEPART_UNPARTITIONED 0xF
+
+#define FTFL_BASE 0x40020000
+#define FTFL_FSTAT (*(volatile uint8_t*)(FTFL_BASE + 0x0))
+#define FTFL_FCCOB(n) (*(volatile uint8_t*)(FTFL_BASE + 0x4 + ((n) & ~3) + 3 - ((n) & 3)))
+#define FTFL_FSTAT_CCIF 0x80
+#define FTFL_FSTAT_ACCERR 0x20
+#define FTFL_FSTAT_FPVIOL 0x10
+#define FTFL_FSTAT_MGSTAT0 0x01
+#define FTFL_PROGRAM_LONGWORD 0x06
+#define FTFL_ERASE_SECTOR 0x09
+
+#define RECORD_MAGIC 0x4B484D31 // "KHM1"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t counts[MATRIX_ROWS][MATRIX_COLS];
+    uint32_t checksum;
+} heatmap_record_t;
+
+#define RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE / sizeof(heatmap_record_t))
+#define NUM_SLOTS (HEATMAP_SECTORS * RECORDS_PER_SECTOR)
+
+uint32_t key_heatmap_counts[MATRIX_ROWS][MATRIX_COLS];
+
+static bool flash_available = false;
+static const heatmap_record_t* latest_record = NULL;
+static unsigned next_slot = 0;
+static heatmap_record_t new_record;
+static thread_t* heatmap_thread = NULL;
+static THD_WORKING_AREA(waHeatmapThread, 256);
+
+static uint32_t slot_offset(unsigned slot) {
+    return HEATMAP_FLASH_OFFSET + (slot / RECORDS_PER_SECTOR) * FLASH_SECTOR_SIZE +
+        (slot % RECORDS_PER_SECTOR) * sizeof(heatmap_record_t);
+}
+
+static const heatmap_record_t* slot_record(unsigned slot) {
+    return (const heatmap_record_t*)(DATA_FLASH_BASE + slot_offset(slot));
+}
+
+static uint32_t checksum(const heatmap_record_t* record) {
+    uint32_t sum = record->sequence;
+    const uint32_t* counts = &record->counts[0][0];
+    for (unsigned i = 0; i < MATRIX_ROWS * MATRIX_COLS; i++) {
+        sum = ((sum << 5) | (sum >> 27)) ^ counts[i];
+    }
+    return ~sum;
+}
+
+static bool is_valid(const heatmap_record_t* record) {
+    return record->magic == RECORD_MAGIC && record->checksum == checksum(record);
+}
+
+static bool is_erased(const void* address, unsigned size) {
+    const uint32_t* words = address;
+    for (unsigned i = 0; i < size / 4; i++) {
+        if (words[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Runs a flash command that has been set up in FCCOB, the wait is only long
+// for erases, so only they sleep
+static bool run_command(bool sleep) {
+    FTFL_FSTAT = FTFL_FSTAT_ACCERR | FTFL_FSTAT_FPVIOL;
+    FTFL_FSTAT = FTFL_FSTAT_CCIF;
+    while (!(FTFL_FSTAT & FTFL_FSTAT_CCIF)) {
+        if (sleep) {
+            chThdSleepMilliseconds(1);
+        }
+    }
+    return !(FTFL_FSTAT & (FTFL_FSTAT_ACCERR | FTFL_FSTAT_FPVIOL | FTFL_FSTAT_MGSTAT0));
+}
+
+static void set_command(uint8_t command, uint32_t offset) {
+    uint32_t address = DATA_FLASH_COMMAND_BASE + offset;
+    FTFL_FCCOB(0) = command;
+    FTFL_FCCOB(1) = address >> 16;
+    FTFL_FCCOB(2) = address >> 8;
+    FTFL_FCCOB(3) = address;
+}
+
+static bool erase_sector(unsigned slot) {
+    set_command(FTFL_ERASE_SECTOR, slot_offset(slot));
+    return run_command(true);
+}
+
+static bool program_word(uint32_t offset, uint32_t value) {
+    set_command(FTFL_PROGRAM_LONGWORD, offset);
+    FTFL_FCCOB(4) = value >> 24;
+    FTFL_FCCOB(5) = value >> 16;
+    FTFL_FCCOB(6) = value >> 8;
+    FTFL_FCCOB(7) = value;
+    return run_command(false);
+}
+
+// Finds the next erased slot, erasing the sectors that the log enters. The
+// sector of the latest record is never reached before an erased slot.
+static bool prepare_slot(void) {
+    for (unsigned i = 0; i < NUM_SLOTS; i++) {
+        if (next_slot % RECORDS_PER_SECTOR == 0) {
+            const void* sector = slot_record(next_slot);
+            if (!is_erased(sector, FLASH_SECTOR_SIZE) && !erase_sector(next_slot)) {
+                return false;
+            }
+        }
+        if (is_erased(slot_record(next_slot), sizeof(heatmap_record_t))) {
+            return true;
+        }
+        next_slot = (next_slot + 1) % NUM_SLOTS;
+    }
+    return false;
+}
+
+// The magic is programmed last, so a record that was interrupted by a reset
+// is never taken as valid
+static bool write_record(unsigned slot, const heatmap_record_t* record) {
+    uint32_t offset = slot_offset(slot);
+    const uint32_t* words = (const uint32_t*)record;
+    for (unsigned i = 1; i < sizeof(heatmap_record_t) / 4; i++) {
+        if (!program_word(offset + i * 4, words[i])) {
+            return false;
+        }
+    }
+    return program_word(offset, record->magic);
+}
+
+static void flush(void) {
+    // The counts can change while they are copied, but each count is read
+    // with a single load
+    memcpy(new_record.counts, key_heatmap_counts, sizeof(new_record.counts));
+    if (latest_record &&
+            memcmp(new_record.counts, latest_record->counts, sizeof(new_record.counts)) == 0) {
+        return;
+    }
+    new_record.magic = RECORD_MAGIC;
+    new_record.sequence = latest_record ? latest_record->sequence + 1 : 0;
+    new_record.checksum = checksum(&new_record);
+    if (!prepare_slot()) {
+        TRACE("heatmap: no free slot\n");
+        return;
+    }
+    unsigned slot = next_slot;
+    // A failed slot is skipped, and the next flush tries the next one
+    next_slot = (next_slot + 1) % NUM_SLOTS;
+    if (write_record(slot, &new_record) && is_valid(slot_record(slot))) {
+        latest_record = slot_record(slot);
+        TRACE("heatmap: saved %u to slot %u\n", (unsigned)new_record.sequence, slot);
+    }
+    else {
+        TRACE("heatmap: writing slot %u failed\n", slot);
+    }
+}
+
+static THD_FUNCTION(heatmapThread, arg) {
+    (void)arg;
+    chRegSetThreadName("heatmap");
+    while (true) {
+        chEvtWaitAnyTimeout(ALL_EVENTS, KEY_HEATMAP_FLUSH_INTERVAL);
+        flush();
+    }
+}
+
+static void load(void) {
+    for (unsigned slot = 0; slot < NUM_SLOTS; slot++) {
+        const heatmap_record_t* record = slot_record(slot);
+        if (!is_valid(record)) {
+            continue;
+        }
+        // The sequence numbers are compared as a difference, so that they
+        // can wrap around
+        if (!latest_record || (int32_t)(record->sequence - latest_record->sequence) > 0) {
+            latest_record = record;
+            next_slot = (slot + 1) % NUM_SLOTS;
+        }
+    }
+    if (latest_record) {
+        memcpy(key_heatmap_counts, latest_record->counts, sizeof(key_heatmap_counts));
+    }
+}
+
+void key_heatmap_init(void) {
+    uint32_t depart = (SIM->FCFG1 & SIM_FCFG1_DEPART_MASK) >> SIM_FCFG1_DEPART_SHIFT;
+    flash_available = depart == DEPART_ALL_DATA_FLASH || depart == DEPART_UNPARTITIONED;
+    if (!flash_available) {
+        return;
+    }
+    load();
+    heatmap_thread = chThdCreateStatic(waHeatmapThread, sizeof(waHeatmapThread),
+        KEY_HEATMAP_THREAD_PRIORITY, heatmapThread, NULL);
+}
+
+void key_heatmap_request_flush(void) {
+    if (heatmap_thread) {
+        chEvtSignal(heatmap_thread, EVENT_MASK(0));
+    }
+}
+
+void key_heatmap_print(void) {
+    xprintf("\nKey presses%s\n", flash_available ? "" : " (not stored)");
+    xprintf("r/c %10d %10d %10d %10d %10d\n", 0, 1, 2, 3, 4);
+    for (int row = 0; row < MATRIX_ROWS; row++) {
+        xprintf("%2d:", row);
+        for (int col = 0; col < MATRIX_COLS; col++) {
+            xprintf(" %10lu", (unsigned long)key_heatmap_counts[row][col]);
+        }
+        xprintf("\n");
+    }
+}
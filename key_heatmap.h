@@ -0,0 +1,50 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEY_HEATMAP_H_
+#define KEY_HEATMAP_H_
+
+#include <stdint.h>
+#include "ch.h"
+#include "config.h"
+#include "keyboard.h"
+
+// Counts the presses of each key of the matrix. The counts are stored in the
+// FlexNVM data flash by a low priority thread, and printed with the "U"
+// console command.
+
+// How often the counts are stored, if they have changed
+#define KEY_HEATMAP_FLUSH_INTERVAL S2ST(10 * 60)
+// The thread only stores the counts, so it runs below everything else
+#define KEY_HEATMAP_THREAD_PRIORITY LOWPRIO
+
+// The counts saturate instead of wrapping around. Read only outside this module.
+extern uint32_t key_heatmap_counts[MATRIX_ROWS][MATRIX_COLS];
+
+// Called by the keyboard thread for every debounced key press
+static inline void key_heatmap_record(keypos_t key) {
+    uint32_t* count = &key_heatmap_counts[key.row][key.col];
+    *count += *count != UINT32_MAX;
+}
+
+// Loads the stored counts and starts the thread that stores them
+void key_heatmap_init(void);
+// Asks the thread to store the counts now, for example before suspending
+void key_heatmap_request_flush(void);
+void key_heatmap_print(void);
+
+#endif /* KEY_HEATMAP_H_ */
@@ -16,6 +16,7 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "lcd_backlight.h"
+#include "lcd_backlight_pipeline.h"
 #include "hal.h"
 
 #define RED_PIN 1
@@ -44,6 +45,76 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // Which will reduce the brightness range
 #define PRESCALAR_DEFINE 0
 
+// The low power profile runs the counter at 1/8 of the clock, with MOD reduced
+// by the same amount, so the PWM frequency and brightness stay the same. Only
+// the resolution drops to 13 bits, and the lost bits are dithered instead.
+// What it saves is the counter clock, 9 MHz instead of 72 MHz. The CPU does
+// the same work in both profiles, the same brightness range is dithered, and
+// the overflow interrupt runs at the same 549 Hz while dithering.
+typedef struct {
+    uint8_t prescaler;
+    uint8_t shift;
+} pwm_profile_t;
+
+static const pwm_profile_t pwm_profiles[] = {
+    [LCD_BACKLIGHT_PROFILE_NORMAL] = {PRESCALAR_DEFINE, 0},
+    [LCD_BACKLIGHT_PROFILE_LOW_POWER] = {PRESCALAR_DEFINE + 3, 3},
+};
+
+// Values below the limit are dithered over 2^LCD_BACKLIGHT_DITHER_BITS PWM
+// periods, which still keeps the dithering cycle above 60 Hz. At higher values
+// the difference of one step isn't visible, so those are just rounded.
+#define LCD_BACKLIGHT_DITHER_BITS 3
+#define LCD_BACKLIGHT_DITHER_LIMIT 0x400
+#define LCD_BACKLIGHT_IRQ_PRIORITY 12
+
+#ifndef KINETIS_FTM0_IRQ_VECTOR
+#define KINETIS_FTM0_IRQ_VECTOR Vector138
+#endif
+
+// The fades are written to the CnV registers by DMA. The FTM has no DMA
+// request for the counter overflow, so the DMA channel is triggered by a PIT
+// instead. Only the first four DMA channels can be triggered, and the first two
+// are used by the SPI driver.
+#define LCD_BACKLIGHT_FADE_DMA_CHANNEL 3
+#define LCD_BACKLIGHT_FADE_PIT_CHANNEL LCD_BACKLIGHT_FADE_DMA_CHANNEL
+// One of the always enabled DMA sources, the request is gated by the trigger
+#define LCD_BACKLIGHT_FADE_DMA_SOURCE 63
+#define LCD_BACKLIGHT_FADE_DMA_IRQ DMA3_IRQn
+
+#ifndef KINETIS_DMA3_IRQ_VECTOR
+#define KINETIS_DMA3_IRQ_VECTOR Vector4C
+#endif
+
+#define FADE_DMA DMA->TCD[LCD_BACKLIGHT_FADE_DMA_CHANNEL]
+#define FADE_PIT PIT->CHANNEL[LCD_BACKLIGHT_FADE_PIT_CHANNEL]
+#define CHANNEL_STRIDE sizeof(FTM0->CHANNEL[0])
+
+#define DITHER_STEPS (1 << LCD_BACKLIGHT_DITHER_BITS)
+#define DITHER_SHIFT (LCD_BACKLIGHT_FRACTION_BITS - LCD_BACKLIGHT_DITHER_BITS)
+
+static uint16_t dither_base[3];
+static uint8_t dither_fraction[3];
+static uint8_t dither_phase;
+
+static lcd_backlight_profile_t current_profile = LCD_BACKLIGHT_PROFILE_NORMAL;
+static uint8_t current_shift = 0;
+// The last color that was set, or the last fade step that was shown
+static uint32_t current_color[3];
+static bool fade_active = false;
+// The steps of the fade in the format returned by lcd_backlight_pipeline_gamma.
+// The steps that need dithering are shown one by one from a virtual timer.
+// Each run of other steps is converted to whole counts in the resolution of
+// the current profile, and written by the DMA
+static const lcd_backlight_fade_step_t* fade_steps;
+static unsigned fade_num_steps = 0;
+static unsigned fade_position = 0;
+static unsigned fade_dma_steps;
+static systime_t fade_step_time;
+static uint32_t fade_step_cycles;
+static lcd_backlight_fade_step_t fade_counts[LCD_BACKLIGHT_FADE_STEPS];
+static virtual_timer_t fade_timer;
+
 void lcd_backlight_hal_init(void) {
 	// Setup Backlight
     SIM->SCGC6 |= SIM_SCGC6_FTM0;
@@ -51,7 +122,7 @@ void lcd_backlight_hal_init(void) {
 
 	// PWM Period
 	// 16-bit maximum
-	FTM0->MOD = 0xFFFF;
+	FTM0->MOD = 0xFFFF >> pwm_profiles[current_profile].shift;
 
 	// Set FTM to PWM output - Edge Aligned, Low-true pulses
 #define CNSC_MODE FTM_SC_CPWMS | FTM_SC_PS(4) | FTM_SC_CLKS(0)
@@ -60,12 +131,24 @@ void lcd_backlight_hal_init(void) {
 	CHANNEL_BLUE.CnSC = CNSC_MODE;
 
 	// System clock, /w prescalar setting
-	FTM0->SC = FTM_SC_CLKS(1) | FTM_SC_PS(PRESCALAR_DEFINE);
+	FTM0->SC = FTM_SC_CLKS(1) | FTM_SC_PS(pwm_profiles[current_profile].prescaler);
 
 	CHANNEL_RED.CnV = 0;
 	CHANNEL_GREEN.CnV = 0;
 	CHANNEL_BLUE.CnV = 0;
 
+	// The overflow interrupt is only enabled while dithering
+	nvicEnableVector(FTM0_IRQn, LCD_BACKLIGHT_IRQ_PRIORITY);
+	nvicEnableVector(LCD_BACKLIGHT_FADE_DMA_IRQ, LCD_BACKLIGHT_IRQ_PRIORITY);
+	chVTObjectInit(&fade_timer);
+
+	SIM->SCGC6 |= SIM_SCGC6_DMAMUX | SIM_SCGC6_PIT;
+	SIM->SCGC7 |= SIM_SCGC7_DMA;
+	// The minor loop offset rewinds the destination back to the red channel
+	// after each step. This doesn't affect the channels that don't use it
+	DMA->CR |= DMA_CR_EMLM;
+	PIT->MCR = 0;
+
 	RGB_PORT_GPIO->PDDR |= (1 << RED_PIN);
 	RGB_PORT_GPIO->PDDR |= (1 << GREEN_PIN);
 	RGB_PORT_GPIO->PDDR |= (1 << BLUE_PIN);
@@ -76,9 +159,260 @@ void lcd_backlight_hal_init(void) {
     RGB_PORT->PCR[BLUE_PIN] = RGB_MODE;
 }
 
+// Bit reversed phase, so that the on periods of each fraction are spread out
+// as evenly as possible
+static uint8_t dither_threshold(uint8_t phase) {
+    uint8_t threshold = 0;
+    for (int i = 0; i < LCD_BACKLIGHT_DITHER_BITS; i++) {
+        threshold = (threshold << 1) | ((phase >> i) & 1);
+    }
+    return threshold;
+}
+
+static void write_dithered_values(void) {
+    uint8_t threshold = dither_threshold(dither_phase);
+	CHANNEL_RED.CnV = dither_base[0] + (threshold < dither_fraction[0]);
+	CHANNEL_GREEN.CnV = dither_base[1] + (threshold < dither_fraction[1]);
+	CHANNEL_BLUE.CnV = dither_base[2] + (threshold < dither_fraction[2]);
+}
+
+// The new values are latched at the end of the current period, so they are
+// written one period ahead
+OSAL_IRQ_HANDLER(KINETIS_FTM0_IRQ_VECTOR) {
+    OSAL_IRQ_PROLOGUE();
+    // The flag is cleared by reading it set and then writing a zero
+    if (FTM0->SC & FTM_SC_TOF) {
+        FTM0->SC &= ~FTM_SC_TOF;
+    }
+    // An overflow can still be pending when a fade takes over the registers
+    if (FTM0->SC & FTM_SC_TOIE) {
+        dither_phase = (dither_phase + 1) & (DITHER_STEPS - 1);
+        write_dithered_values();
+    }
+    OSAL_IRQ_EPILOGUE();
+}
+
+// Rounds a value in the format returned by lcd_backlight_pipeline_gamma to the
+// whole counts of the current profile
+static uint32_t fade_value(uint32_t value) {
+    uint32_t max = 0xFFFFu >> current_shift;
+    value = (value + (1 << (LCD_BACKLIGHT_FRACTION_BITS + current_shift - 1))) >>
+        (LCD_BACKLIGHT_FRACTION_BITS + current_shift);
+    return value > max ? max : value;
+}
+
+// Whether the value is in the range that split_value dithers. The whole range
+// is tested, so that the low part of a fade is one run of steps, instead of
+// switching to the DMA for every step that happens to have no fraction
+static bool needs_dither(uint32_t value) {
+    uint16_t base = (value >> current_shift) >> LCD_BACKLIGHT_FRACTION_BITS;
+    return value != 0 && base < (LCD_BACKLIGHT_DITHER_LIMIT >> current_shift);
+}
+
+static bool step_needs_dither(const lcd_backlight_fade_step_t* step) {
+    return needs_dither(step->red) || needs_dither(step->green) || needs_dither(step->blue);
+}
+
+// The values are scaled to the resolution of the current profile first
+static void split_value(int channel, uint32_t value) {
+    uint32_t scaled = value >> current_shift;
+    uint16_t base = scaled >> LCD_BACKLIGHT_FRACTION_BITS;
+    if (base < (LCD_BACKLIGHT_DITHER_LIMIT >> current_shift)) {
+        dither_base[channel] = base;
+        dither_fraction[channel] = (scaled >> DITHER_SHIFT) & (DITHER_STEPS - 1);
+    }
+    else {
+        dither_base[channel] = fade_value(value);
+        dither_fraction[channel] = 0;
+    }
+}
+
+static void write_color_s(void) {
+    split_value(0, current_color[0]);
+    split_value(1, current_color[1]);
+    split_value(2, current_color[2]);
+    write_dithered_values();
+    if (dither_fraction[0] | dither_fraction[1] | dither_fraction[2]) {
+        FTM0->SC |= FTM_SC_TOIE;
+    }
+    else {
+        FTM0->SC &= ~FTM_SC_TOIE;
+    }
+}
+
+// Stops the DMA or the timer, and moves the fade position and the current
+// color to the last step that was shown
+static void stop_fade_s(void) {
+    if (chVTIsArmedI(&fade_timer)) {
+        chVTResetI(&fade_timer);
+    }
+    FADE_PIT.TCTRL = 0;
+    DMA->CERQ = LCD_BACKLIGHT_FADE_DMA_CHANNEL;
+    // Let a step that is being written finish
+    while (FADE_DMA.CSR & DMA_CSR_ACTIVE) {
+    }
+    DMAMUX->CHCFG[LCD_BACKLIGHT_FADE_DMA_CHANNEL] = 0;
+    if (!fade_active) {
+        return;
+    }
+    fade_active = false;
+    unsigned written = fade_dma_steps;
+    if (!(FADE_DMA.CSR & DMA_CSR_DONE)) {
+        written -= FADE_DMA.CITER_ELINKNO;
+    }
+    fade_position += written;
+    if (fade_position > 0) {
+        const lcd_backlight_fade_step_t* step = &fade_steps[fade_position - 1];
+        current_color[0] = step->red;
+        current_color[1] = step->green;
+        current_color[2] = step->blue;
+    }
+}
+
+static void fade_timer_callback(void* arg);
+
+// Continues the fade from fade_position in the resolution of the current
+// profile. A step that needs dithering is shown by the timer, otherwise the
+// DMA writes steps until the next one that needs dithering
+static void start_fade_s(void) {
+    if (fade_position == fade_num_steps) {
+        return;
+    }
+    if (step_needs_dither(&fade_steps[fade_position])) {
+        chVTSetI(&fade_timer, fade_step_time, fade_timer_callback, NULL);
+        return;
+    }
+    unsigned num_steps = 0;
+    while (fade_position + num_steps < fade_num_steps &&
+            !step_needs_dither(&fade_steps[fade_position + num_steps])) {
+        const lcd_backlight_fade_step_t* step = &fade_steps[fade_position + num_steps];
+        fade_counts[num_steps].red = fade_value(step->red);
+        fade_counts[num_steps].green = fade_value(step->green);
+        fade_counts[num_steps].blue = fade_value(step->blue);
+        num_steps++;
+    }
+    // The steps are whole counts, so there's nothing to dither
+    FTM0->SC &= ~FTM_SC_TOIE;
+    fade_active = true;
+    fade_dma_steps = num_steps;
+
+    // Each trigger writes one step, the red, green and blue values in order,
+    // eight bytes apart. The request is disabled by the hardware after the last
+    // step, so nothing runs on the CPU until then
+    FADE_DMA.SADDR = (uint32_t)fade_counts;
+    FADE_DMA.SOFF = sizeof(uint32_t);
+    FADE_DMA.ATTR = DMA_ATTR_SSIZE(2) | DMA_ATTR_DSIZE(2);
+    FADE_DMA.NBYTES_MLNO = DMA_NBYTES_MLOFFYES_DMLOE |
+        DMA_NBYTES_MLOFFYES_MLOFF(-3 * (int32_t)CHANNEL_STRIDE) |
+        DMA_NBYTES_MLOFFYES_NBYTES(sizeof(lcd_backlight_fade_step_t));
+    FADE_DMA.SLAST = 0;
+    FADE_DMA.DADDR = (uint32_t)&CHANNEL_RED.CnV;
+    FADE_DMA.DOFF = CHANNEL_STRIDE;
+    FADE_DMA.CITER_ELINKNO = num_steps;
+    FADE_DMA.BITER_ELINKNO = num_steps;
+    FADE_DMA.DLASTSGA = 0;
+    // This also clears the done flag of the previous run. The interrupt at the
+    // end continues with the rest of the fade
+    FADE_DMA.CSR = DMA_CSR_DREQ | (fade_position + num_steps < fade_num_steps ? DMA_CSR_INTMAJOR : 0);
+
+    DMAMUX->CHCFG[LCD_BACKLIGHT_FADE_DMA_CHANNEL] = DMAMUX_CHCFGn_ENBL |
+        DMAMUX_CHCFGn_TRIG | DMAMUX_CHCFGn_SOURCE(LCD_BACKLIGHT_FADE_DMA_SOURCE);
+    DMA->SERQ = LCD_BACKLIGHT_FADE_DMA_CHANNEL;
+
+    FADE_PIT.LDVAL = fade_step_cycles;
+    FADE_PIT.TCTRL = PIT_TCTRL_TEN;
+}
+
+static void fade_timer_callback(void* arg) {
+    (void)arg;
+    chSysLockFromISR();
+    const lcd_backlight_fade_step_t* step = &fade_steps[fade_position++];
+    current_color[0] = step->red;
+    current_color[1] = step->green;
+    current_color[2] = step->blue;
+    write_color_s();
+    start_fade_s();
+    chSysUnlockFromISR();
+}
+
+OSAL_IRQ_HANDLER(KINETIS_DMA3_IRQ_VECTOR) {
+    OSAL_IRQ_PROLOGUE();
+    DMA->CINT = LCD_BACKLIGHT_FADE_DMA_CHANNEL;
+    chSysLockFromISR();
+    stop_fade_s();
+    start_fade_s();
+    chSysUnlockFromISR();
+    OSAL_IRQ_EPILOGUE();
+}
+
+// Stopping the fade leaves the backlight at the step it had reached
+static void cancel_fade_s(void) {
+    stop_fade_s();
+    fade_num_steps = 0;
+    fade_position = 0;
+}
+
+void lcd_backlight_hal_stop_fade(void) {
+    chSysLock();
+    cancel_fade_s();
+    write_color_s();
+    chSysUnlock();
+}
+
+void lcd_backlight_hal_fade(const lcd_backlight_fade_step_t* steps, unsigned num_steps, systime_t step_time) {
+    chSysLock();
+    cancel_fade_s();
+    fade_steps = steps;
+    fade_num_steps = num_steps < LCD_BACKLIGHT_FADE_STEPS ? num_steps : LCD_BACKLIGHT_FADE_STEPS;
+    // The PIT runs from the bus clock
+    uint32_t cycles = step_time * (KINETIS_BUSCLK_FREQUENCY / CH_CFG_ST_FREQUENCY);
+    fade_step_cycles = cycles > 0 ? cycles - 1 : 0;
+    fade_step_time = step_time > 0 ? step_time : 1;
+    start_fade_s();
+    chSysUnlock();
+}
+
+static void set_color_s(uint32_t r, uint32_t g, uint32_t b) {
+    cancel_fade_s();
+    current_color[0] = r;
+    current_color[1] = g;
+    current_color[2] = b;
+    write_color_s();
+}
+
+void lcd_backlight_hal_color_fine(uint32_t r, uint32_t g, uint32_t b) {
+    chSysLock();
+    set_color_s(r, g, b);
+    chSysUnlock();
+}
+
+void lcd_backlight_hal_set_profile(lcd_backlight_profile_t profile) {
+    chSysLock();
+    if (profile == current_profile) {
+        chSysUnlock();
+        return;
+    }
+    // A running fade is paused at the step it has reached, and the rest of
+    // the steps are converted again for the new resolution
+    stop_fade_s();
+    current_profile = profile;
+    current_shift = pwm_profiles[profile].shift;
+
+    // The counter is stopped while the period is changed, so that it doesn't
+    // have to count up to the old MOD first
+    FTM0->SC = 0;
+    FTM0->CNT = 0;
+    FTM0->MOD = 0xFFFF >> current_shift;
+    FTM0->SC = FTM_SC_CLKS(1) | FTM_SC_PS(pwm_profiles[profile].prescaler);
+    write_color_s();
+    start_fade_s();
+    chSysUnlock();
+}
+
 void lcd_backlight_hal_color(uint16_t r, uint16_t g, uint16_t b) {
-	CHANNEL_RED.CnV = r;
-	CHANNEL_GREEN.CnV = g;
-	CHANNEL_BLUE.CnV = b;
+    lcd_backlight_hal_color_fine(
+        (uint32_t)r << LCD_BACKLIGHT_FRACTION_BITS,
+        (uint32_t)g << LCD_BACKLIGHT_FRACTION_BITS,
+        (uint32_t)b << LCD_BACKLIGHT_FRACTION_BITS);
 }
 
@@ -0,0 +1,206 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lcd_backlight_pipeline.h"
+#include "lcd_backlight.h"
+
+// The CIE 1931 lightness curve sampled at 257 points of the 16-bit input range
+// L = 100 * i / 256
+// Y = L / 902.3             if L <= 8
+// Y = ((L + 16) / 116)^3    if L > 8
+// The output is Y scaled to the full 0xFFFF range of FTM0->MOD
+static const uint16_t gamma_table[257] = {
+        0,    28,    57,    85,   113,   142,   170,   199,
+      227,   255,   284,   312,   340,   369,   397,   426,
+      454,   482,   511,   539,   567,   595,   625,   655,
+      686,   718,   751,   785,   821,   857,   894,   933,
+      972,  1012,  1054,  1097,  1141,  1186,  1232,  1279,
+     1328,  1378,  1429,  1481,  1535,  1590,  1646,  1703,
+     1762,  1822,  1883,  1946,  2010,  2076,  2143,  2211,
+     2281,  2352,  2425,  2500,  2575,  2653,  2731,  2812,
+     2894,  2977,  3062,  3149,  3237,  3327,  3419,  3512,
+     3607,  3704,  3802,  3902,  4004,  4108,  4213,  4320,
+     4429,  4540,  4652,  4767,  4883,  5001,  5121,  5243,
+     5367,  5493,  5621,  5751,  5882,  6016,  6152,  6289,
+     6429,  6571,  6715,  6861,  7009,  7159,  7312,  7466,
+     7623,  7782,  7943,  8106,  8272,  8439,  8609,  8781,
+     8956,  9133,  9312,  9493,  9677,  9863, 10052, 10243,
+    10436, 10632, 10830, 11030, 11234, 11439, 11647, 11858,
+    12071, 12286, 12504, 12725, 12948, 13174, 13403, 13634,
+    13868, 14104, 14343, 14585, 14830, 15077, 15327, 15579,
+    15835, 16093, 16354, 16618, 16885, 17154, 17426, 17702,
+    17980, 18261, 18545, 18831, 19121, 19414, 19710, 20008,
+    20310, 20615, 20922, 21233, 21547, 21864, 22184, 22507,
+    22833, 23163, 23495, 23831, 24170, 24512, 24857, 25206,
+    25558, 25913, 26271, 26632, 26997, 27366, 27737, 28112,
+    28490, 28872, 29257, 29645, 30037, 30432, 30831, 31233,
+    31639, 32048, 32461, 32877, 33297, 33720, 34147, 34578,
+    35012, 35450, 35891, 36336, 36785, 37237, 37693, 38153,
+    38616, 39083, 39554, 40029, 40507, 40990, 41476, 41966,
+    42460, 42957, 43459, 43964, 44473, 44987, 45504, 46025,
+    46550, 47079, 47612, 48149, 48690, 49235, 49785, 50338,
+    50895, 51457, 52022, 52592, 53166, 53744, 54326, 54912,
+    55503, 56097, 56696, 57300, 57907, 58519, 59135, 59755,
+    60380, 61009, 61642, 62280, 62922, 63569, 64220, 64875,
+    65535,
+};
+
+static uint8_t current_brightness = 0xFF;
+
+static lcd_backlight_fade_step_t fade_steps[LCD_BACKLIGHT_FADE_STEPS];
+static bool fade_running = false;
+static uint32_t fade_from;
+static uint32_t fade_to;
+static systime_t fade_start;
+static systime_t fade_duration;
+
+// a * b / 0xFFFF, exact at both ends of the range
+static uint16_t scale16(uint16_t a, uint16_t b) {
+    return ((uint32_t)a * b + 0xFFFF) >> 16;
+}
+
+uint32_t lcd_backlight_pipeline_gamma(uint16_t lightness) {
+    // Linear interpolation between the table entries, the fractional part of
+    // the index is kept as the fractional part of the result. 0xFFFF is
+    // stretched to 0x10000, so that full lightness hits the last entry
+    uint32_t position = lightness + (lightness >> 15);
+    unsigned index = position >> 8;
+    if (index == 256) {
+        return (uint32_t)gamma_table[256] << LCD_BACKLIGHT_FRACTION_BITS;
+    }
+    uint32_t frac = position & 0xFF;
+    uint32_t low = gamma_table[index];
+    uint32_t high = gamma_table[index + 1];
+    uint32_t value = (low << 8) + (high - low) * frac;
+    return value >> (8 - LCD_BACKLIGHT_FRACTION_BITS);
+}
+
+void lcd_backlight_pipeline_brightness(uint8_t b) {
+    current_brightness = b;
+}
+
+static void hsv_to_rgb(const uint16_t* hsv, uint32_t* rgb) {
+    // Standard sector based HSV to RGB conversion, with the position inside
+    // the sector as a 16-bit fraction
+    uint16_t hue = hsv[0];
+    uint16_t saturation = hsv[1];
+    uint32_t h6 = (uint32_t)hue * 6;
+    unsigned sector = h6 >> 16;
+    uint16_t f = h6 & 0xFFFF;
+    uint16_t v = hsv[2];
+    uint16_t p = scale16(v, 0xFFFF - saturation);
+    uint16_t q = scale16(v, 0xFFFF - scale16(saturation, f));
+    uint16_t t = scale16(v, 0xFFFF - scale16(saturation, 0xFFFF - f));
+    uint16_t r, g, b;
+    switch (sector) {
+    case 0:
+        r = v; g = t; b = p;
+        break;
+    case 1:
+        r = q; g = v; b = p;
+        break;
+    case 2:
+        r = p; g = v; b = t;
+        break;
+    case 3:
+        r = p; g = q; b = v;
+        break;
+    case 4:
+        r = t; g = p; b = v;
+        break;
+    default:
+        r = v; g = p; b = q;
+        break;
+    }
+    uint16_t brightness = current_brightness * 0x101;
+    rgb[0] = lcd_backlight_pipeline_gamma(scale16(r, brightness));
+    rgb[1] = lcd_backlight_pipeline_gamma(scale16(g, brightness));
+    rgb[2] = lcd_backlight_pipeline_gamma(scale16(b, brightness));
+}
+
+void lcd_backlight_pipeline_interpolate(uint32_t from, uint32_t to, int32_t t, uint16_t* hsv) {
+    uint16_t p_h = LCD_HUE(from) << 8;
+    uint16_t p_s = LCD_SAT(from) << 8;
+    uint16_t p_i = LCD_INT(from) << 8;
+    uint16_t t_h = LCD_HUE(to) << 8;
+    uint16_t t_s = LCD_SAT(to) << 8;
+    uint16_t t_i = LCD_INT(to) << 8;
+    // Take the shortest way around the hue circle
+    int32_t d_h = (int16_t)(uint16_t)(t_h - p_h);
+    int32_t d_s = t_s - p_s;
+    int32_t d_i = t_i - p_i;
+
+    uint16_t sat = p_s + ((d_s * t) >> 15);
+    uint16_t intensity = p_i + ((d_i * t) >> 15);
+    hsv[0] = p_h + ((d_h * t) >> 15);
+    // The 8-bit components are rescaled to the full 16-bit range
+    hsv[1] = sat | (sat >> 8);
+    hsv[2] = intensity | (intensity >> 8);
+}
+
+// Converts the position inside a fade to a 15-bit fraction, while keeping
+// the math in 32 bits even for long fades
+static int32_t fade_fraction(systime_t pos, systime_t length) {
+    while (length > 0x7FFF) {
+        length >>= 1;
+        pos >>= 1;
+    }
+    if (length == 0) {
+        return 1 << 15;
+    }
+    return ((int32_t)pos << 15) / (int32_t)length;
+}
+
+void lcd_backlight_pipeline_fade(uint32_t from, uint32_t to, systime_t duration) {
+    // The hardware has to be stopped before the steps can be overwritten
+    lcd_backlight_hal_stop_fade();
+    systime_t now = chVTGetSystemTimeX();
+    if (fade_running) {
+        systime_t elapsed = now - fade_start;
+        if (elapsed < fade_duration) {
+            uint16_t hsv[3];
+            lcd_backlight_pipeline_interpolate(fade_from, fade_to,
+                fade_fraction(elapsed, fade_duration), hsv);
+            from = LCD_COLOR(hsv[0] >> 8, hsv[1] >> 8, hsv[2] >> 8);
+        }
+        else {
+            from = fade_to;
+        }
+    }
+
+    unsigned num_steps = LCD_BACKLIGHT_FADE_STEPS;
+    if (duration < num_steps) {
+        num_steps = duration > 0 ? duration : 1;
+    }
+    for (unsigned i = 0; i < num_steps; i++) {
+        uint16_t hsv[3];
+        uint32_t rgb[3];
+        lcd_backlight_pipeline_interpolate(from, to,
+            fade_fraction(i + 1, num_steps), hsv);
+        hsv_to_rgb(hsv, rgb);
+        fade_steps[i].red = rgb[0];
+        fade_steps[i].green = rgb[1];
+        fade_steps[i].blue = rgb[2];
+    }
+
+    fade_running = true;
+    fade_from = from;
+    fade_to = to;
+    fade_start = now;
+    fade_duration = duration;
+    lcd_backlight_hal_fade(fade_steps, num_steps, duration / num_steps);
+}
@@ -0,0 +1,84 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LCD_BACKLIGHT_PIPELINE_H_
+#define LCD_BACKLIGHT_PIPELINE_H_
+
+#include "ch.h"
+
+// The pipeline converts a color to the PWM values of the backlight using only
+// integer math. The values passed to the hal have this many fractional bits,
+// which are used for dithering the lowest levels
+#define LCD_BACKLIGHT_FRACTION_BITS 8
+
+// Works like lcd_backlight_brightness, and should be set to the same value
+void lcd_backlight_pipeline_brightness(uint8_t b);
+
+// Interpolates between two LCD_COLOR values, taking the shortest way around
+// the hue circle. The position t is a 15-bit fraction, and the result is
+// stored as hue, saturation and intensity. The full circle of the hue is
+// 0x10000, so that it wraps around naturally. The saturation and intensity use
+// the full 16-bit range, and are not limited to the 8-bit values of LCD_COLOR
+void lcd_backlight_pipeline_interpolate(uint32_t from, uint32_t to, int32_t t, uint16_t* hsv);
+
+// Fades between two LCD_COLOR values in hardware, so that nothing has to run on
+// the CPU until the fade is complete. Only the steps in the dithered range at
+// the low end are shown one by one, so that they don't step visibly. If a
+// previous fade is still running, the new one starts from wherever the old one
+// currently is, instead of from the given color. Setting a color stops the
+// fade.
+void lcd_backlight_pipeline_fade(uint32_t from, uint32_t to, systime_t duration);
+
+// Converts a linear lightness into a PWM value with LCD_BACKLIGHT_FRACTION_BITS
+// fractional bits
+uint32_t lcd_backlight_pipeline_gamma(uint16_t lightness);
+
+// Implemented by lcd_backlight_hal.c, the values are in the same format as
+// returned by lcd_backlight_pipeline_gamma
+void lcd_backlight_hal_color_fine(uint32_t r, uint32_t g, uint32_t b);
+
+// The most steps a hardware fade can have. A one second fade has about 15 ms
+// between the steps, which is too fast to see the individual steps
+#define LCD_BACKLIGHT_FADE_STEPS 64
+
+// One step of a hardware fade, in the format returned by
+// lcd_backlight_pipeline_gamma
+typedef struct {
+    uint32_t red;
+    uint32_t green;
+    uint32_t blue;
+} lcd_backlight_fade_step_t;
+
+// Implemented by lcd_backlight_hal.c, shows one step every step_time until
+// all of them have been shown. The HAL converts the steps to the resolution of
+// the current PWM profile, so they have to stay valid until the fade is
+// complete or stopped
+void lcd_backlight_hal_fade(const lcd_backlight_fade_step_t* steps, unsigned num_steps, systime_t step_time);
+void lcd_backlight_hal_stop_fade(void);
+
+typedef enum {
+    // The full 16-bit resolution
+    LCD_BACKLIGHT_PROFILE_NORMAL,
+    // The same brightness and PWM frequency with an 8 times slower counter
+    // clock and a lower resolution, for when nobody is looking at the
+    // backlight
+    LCD_BACKLIGHT_PROFILE_LOW_POWER,
+} lcd_backlight_profile_t;
+
+void lcd_backlight_hal_set_profile(lcd_backlight_profile_t profile);
+
+#endif /* LCD_BACKLIGHT_PIPELINE_H_ */
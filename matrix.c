@@ -20,11 +20,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include "hal.h"
 #include "timer.h"
-#include "wait.h"
+#include "pit_timer.h"
 #include "print.h"
 #include "debug.h"
 #include "matrix.h"
 #include "serial_link/system/serial_link.h"
+#include "diagnostics.h"
+#include "trace.h"
 
 
 /*
@@ -40,6 +42,9 @@ static matrix_row_t matrix[MATRIX_ROWS];
 static matrix_row_t matrix_debouncing[LOCAL_MATRIX_ROWS];
 static bool debouncing = false;
 static uint16_t debouncing_time = 0;
+// The columns of each row value as text, so that matrix_print can trace a
+// whole row with a single record
+static char row_bits[1 << MATRIX_COLS][MATRIX_COLS + 1];
 
 
 void matrix_init(void)
@@ -64,6 +69,13 @@ void matrix_init(void)
 
     memset(matrix, 0, MATRIX_ROWS);
     memset(matrix_debouncing, 0, LOCAL_MATRIX_ROWS);
+
+    for (int data = 0; data < (1 << MATRIX_COLS); data++) {
+        for (int col = 0; col < MATRIX_COLS; col++) {
+            row_bits[data][col] = (data & (1<<col)) ? '1' : '0';
+        }
+        row_bits[data][MATRIX_COLS] = 0;
+    }
 }
 
 uint8_t matrix_scan(void)
@@ -88,8 +100,9 @@ uint8_t matrix_scan(void)
         // if you wait too short, or have a too high update rate
         // the keyboard might freeze, or there might not be enough
         // processing power to update the LCD screen properly.
-        // 20us, or two ticks at 100000Hz seems to be OK
-        wait_us(20);
+        // 20us seems to be OK, the thread sleeps on the PIT meanwhile, since
+        // it's shorter than a system tick
+        pit_timer_sleep_us(20);
 
         // read col data: { PTD1, PTD4, PTD5, PTD6, PTD7 }
         data = ((palReadPort(GPIOD) & 0xF0) >> 3) |
@@ -109,6 +122,7 @@ uint8_t matrix_scan(void)
         }
 
         if (matrix_debouncing[row] != data) {
+            diagnostics_key_change();
             matrix_debouncing[row] = data;
             debouncing = true;
             debouncing_time = timer_read();
@@ -128,6 +142,7 @@ uint8_t matrix_scan(void)
         }
         debouncing = false;
     }
+    diagnostics_scan();
     return 1;
 }
 
@@ -143,17 +158,9 @@ matrix_row_t matrix_get_row(uint8_t row)
 
 void matrix_print(void)
 {
-    xprintf("\nr/c 01234567\n");
+    TRACE("\nr/c 01234567\n");
     for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
-        xprintf("%X0: ", row);
-        matrix_row_t data = matrix_get_row(row);
-        for (int col = 0; col < MATRIX_COLS; col++) {
-            if (data & (1<<col))
-                xprintf("1");
-            else
-                xprintf("0");
-        }
-        xprintf("\n");
+        TRACE("%X0: %s\n", row, row_bits[matrix_get_row(row) & ((1 << MATRIX_COLS) - 1)]);
     }
 }
 
@@ -164,6 +171,10 @@ void matrix_set_remote(matrix_row_t* rows, uint8_t index) {
 #else
     offset = LOCAL_MATRIX_ROWS * (index + 1);
 #endif
+    diagnostics_link_update();
+    if (memcmp(&matrix[offset], rows, LOCAL_MATRIX_ROWS * sizeof(matrix_row_t)) != 0) {
+        diagnostics_key_change();
+    }
     for (int row = 0; row < LOCAL_MATRIX_ROWS; row++) {
         matrix[offset + row] = rows[row];
     }
@@ -0,0 +1,74 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pit_timer.h"
+#include "ch.h"
+
+#define PIT_TIMER_SLEEP_CHANNEL 1
+#define PIT_TIMER_IRQ_PRIORITY 8
+
+#ifndef KINETIS_PIT1_IRQ_VECTOR
+#define KINETIS_PIT1_IRQ_VECTOR Vector154
+#endif
+
+#define COUNTER_PIT PIT->CHANNEL[PIT_TIMER_COUNTER_CHANNEL]
+#define SLEEP_PIT PIT->CHANNEL[PIT_TIMER_SLEEP_CHANNEL]
+
+static bool initialized = false;
+static thread_reference_t sleeping_thread = NULL;
+
+void pit_timer_init(void) {
+    SIM->SCGC6 |= SIM_SCGC6_PIT;
+    // Enables the timers, and keeps them running in debug mode
+    PIT->MCR = 0;
+
+    COUNTER_PIT.TCTRL = 0;
+    COUNTER_PIT.LDVAL = 0xFFFFFFFF;
+    COUNTER_PIT.TCTRL = PIT_TCTRL_TEN;
+
+    SLEEP_PIT.TCTRL = 0;
+    SLEEP_PIT.TFLG = PIT_TFLG_TIF;
+    nvicEnableVector(PIT1_IRQn, PIT_TIMER_IRQ_PRIORITY);
+    initialized = true;
+}
+
+void pit_timer_sleep_us(uint32_t us) {
+    if (us == 0) {
+        return;
+    }
+    chSysLock();
+    if (!initialized || sleeping_thread != NULL) {
+        chThdSleepS(US2ST(us));
+        chSysUnlock();
+        return;
+    }
+    SLEEP_PIT.LDVAL = us * PIT_TIMER_CYCLES_PER_US - 1;
+    SLEEP_PIT.TCTRL = PIT_TCTRL_TIE | PIT_TCTRL_TEN;
+    chThdSuspendS(&sleeping_thread);
+    chSysUnlock();
+}
+
+OSAL_IRQ_HANDLER(KINETIS_PIT1_IRQ_VECTOR) {
+    OSAL_IRQ_PROLOGUE();
+    // The PIT reloads itself, so it is stopped to make the sleep one shot
+    SLEEP_PIT.TCTRL = 0;
+    SLEEP_PIT.TFLG = PIT_TFLG_TIF;
+    chSysLockFromISR();
+    chThdResumeI(&sleeping_thread, MSG_OK);
+    chSysUnlockFromISR();
+    OSAL_IRQ_EPILOGUE();
+}
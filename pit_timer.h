@@ -0,0 +1,45 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PIT_TIMER_H_
+#define PIT_TIMER_H_
+
+#include <stdint.h>
+#include "hal.h"
+
+// A free running counter and microsecond sleeps, using the periodic interrupt
+// timers. The system tick is too coarse for the sleeps, and unlike the cycle
+// counter of the core, the PIT keeps counting while the idle thread waits for
+// an interrupt.
+
+#define PIT_TIMER_FREQUENCY KINETIS_BUSCLK_FREQUENCY
+#define PIT_TIMER_CYCLES_PER_US (PIT_TIMER_FREQUENCY / 1000000)
+
+#define PIT_TIMER_COUNTER_CHANNEL 0
+
+void pit_timer_init(void);
+
+// Counts up at PIT_TIMER_FREQUENCY, and wraps around in about two minutes
+static inline uint32_t pit_timer_now(void) {
+    return ~PIT->CHANNEL[PIT_TIMER_COUNTER_CHANNEL].CVAL;
+}
+
+// Suspends the calling thread for at least the given time. Only one thread
+// at a time gets the exact timer, the others sleep for whole system ticks.
+void pit_timer_sleep_us(uint32_t us);
+
+#endif /* PIT_TIMER_H_ */
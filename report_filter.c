@@ -0,0 +1,101 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "report_filter.h"
+#include "host.h"
+#include "usb_main.h"
+
+/*
+ * The keyboard report is sent after every processed key event, even when the
+ * event didn't change it, like for layer keys. Only the changed reports are
+ * passed on. The previous report is forgotten when the format can have
+ * changed, that is when the protocol or the NKRO mode changes, and when the
+ * USB has been reset or suspended since it was sent. A report is only
+ * remembered if the USB was active when it was sent, since the USB driver
+ * drops the reports otherwise, and the same report has to be sent again.
+ */
+
+static host_driver_t* wrapped_driver = NULL;
+static report_keyboard_t last_report;
+static bool last_report_valid = false;
+static volatile uint32_t usb_resets = 0;
+static uint32_t last_usb_resets;
+static uint8_t last_protocol;
+#ifdef NKRO_ENABLE
+static bool last_nkro;
+#endif
+
+static bool same_format(void) {
+#ifdef NKRO_ENABLE
+    if (last_nkro != keyboard_nkro) {
+        return false;
+    }
+#endif
+    return last_protocol == keyboard_protocol;
+}
+
+static void send_keyboard(report_keyboard_t* report) {
+    // A reset during the send leaves the count different, so the next report
+    // is sent too
+    uint32_t resets = usb_resets;
+    if (last_report_valid && resets == last_usb_resets && same_format() &&
+            memcmp(&last_report, report, sizeof(last_report)) == 0) {
+        return;
+    }
+    wrapped_driver->send_keyboard(report);
+    memcpy(&last_report, report, sizeof(last_report));
+    last_protocol = keyboard_protocol;
+#ifdef NKRO_ENABLE
+    last_nkro = keyboard_nkro;
+#endif
+    last_usb_resets = resets;
+    last_report_valid = USB_DRIVER.state == USB_ACTIVE;
+}
+
+static uint8_t keyboard_leds(void) {
+    return wrapped_driver->keyboard_leds();
+}
+
+static void send_mouse(report_mouse_t* report) {
+    wrapped_driver->send_mouse(report);
+}
+
+static void send_system(uint16_t data) {
+    wrapped_driver->send_system(data);
+}
+
+static void send_consumer(uint16_t data) {
+    wrapped_driver->send_consumer(data);
+}
+
+static host_driver_t report_filter_driver = {
+    keyboard_leds,
+    send_keyboard,
+    send_mouse,
+    send_system,
+    send_consumer,
+};
+
+void report_filter_usb_reset(void) {
+    usb_resets++;
+}
+
+host_driver_t* report_filter_wrap_driver(host_driver_t* driver) {
+    wrapped_driver = driver;
+    return &report_filter_driver;
+}
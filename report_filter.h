@@ -0,0 +1,32 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REPORT_FILTER_H_
+#define REPORT_FILTER_H_
+
+#include "host_driver.h"
+
+// Returns a host driver that drops the keyboard reports that are the same as
+// the previous one sent through the given driver
+host_driver_t* report_filter_wrap_driver(host_driver_t* driver);
+
+// Makes the next report be sent even if it's unchanged, since the host might
+// have forgotten the keys after a USB reset or suspend. Called from the USB
+// event interrupt.
+void report_filter_usb_reset(void);
+
+#endif /* REPORT_FILTER_H_ */
@@ -0,0 +1,321 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "telemetry.h"
+#include "diagnostics.h"
+#include "serial_link/system/serial_link.h"
+#ifdef VISUALIZER_PROFILER_ENABLE
+#include "visualizer_profiler.h"
+#endif
+
+// The buffer holds whole records, the length must be a power of two
+#define TELEMETRY_BUFFER_SIZE 1024
+// Below all the threads that commit records, so that signaling it never
+// preempts them
+#define TELEMETRY_THREAD_PRIORITY LOWPRIO
+// A report that isn't full is sent after this long
+#define TELEMETRY_FLUSH_INTERVAL MS2ST(10)
+#define TELEMETRY_STATS_INTERVAL S2ST(1)
+
+#define US_PER_TICK (1000000 / CH_CFG_ST_FREQUENCY)
+
+typedef struct {
+    uint8_t data[TELEMETRY_MAX_RECORD_SIZE];
+    uint8_t length;
+} record_t;
+
+static const uint8_t report_descriptor_data[] = {
+    0x06, 0x00, 0xFF,               // Usage Page (Vendor Defined 0xFF00)
+    0x09, 0x01,                     // Usage (0x01)
+    0xA1, 0x01,                     // Collection (Application)
+    0x09, 0x02,                     //   Usage (0x02)
+    0x15, 0x00,                     //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,               //   Logical Maximum (255)
+    0x75, 0x08,                     //   Report Size (8)
+    0x95, TELEMETRY_REPORT_SIZE,    //   Report Count (64)
+    0x81, 0x02,                     //   Input (Data, Variable, Absolute)
+    0xC0,                           // End Collection
+};
+
+const USBDescriptor telemetry_report_descriptor = {
+    sizeof(report_descriptor_data),
+    report_descriptor_data,
+};
+
+// The buffer indices run freely, and are masked when accessed. Everything is
+// protected by the system lock.
+static uint8_t buffer[TELEMETRY_BUFFER_SIZE];
+static uint32_t buffer_head = 0;
+static uint32_t buffer_tail = 0;
+static uint16_t dropped = 0;
+
+static USBDriver* usb_driver = NULL;
+static usbep_t endpoint = 0;
+static volatile bool names_pending = false;
+static uint8_t report[TELEMETRY_REPORT_SIZE];
+static thread_t* telemetry_thread = NULL;
+static THD_WORKING_AREA(waTelemetryThread, 256);
+
+static uint32_t time_us(void) {
+    return (uint32_t)chVTGetSystemTimeX() * US_PER_TICK;
+}
+
+static void begin_record(record_t* record, telemetry_record_type_t type) {
+    record->data[0] = type;
+    record->length = 2;
+}
+
+static void put8(record_t* record, uint8_t value) {
+    record->data[record->length++] = value;
+}
+
+static void put16(record_t* record, uint16_t value) {
+    put8(record, value & 0xFF);
+    put8(record, value >> 8);
+}
+
+static void put32(record_t* record, uint32_t value) {
+    put16(record, value & 0xFFFF);
+    put16(record, value >> 16);
+}
+
+// Nothing is kept while there's no host to read it, so that the host doesn't
+// get old records when it connects
+static bool is_usb_active(void) {
+    return usb_driver != NULL && usb_driver->state == USB_ACTIVE;
+}
+
+static void commit_record(record_t* record) {
+    record->data[1] = record->length;
+    chSysLock();
+    if (is_usb_active()) {
+        if (TELEMETRY_BUFFER_SIZE - (buffer_head - buffer_tail) >= record->length) {
+            bool was_empty = buffer_head == buffer_tail;
+            for (uint8_t i = 0; i < record->length; i++) {
+                buffer[buffer_head++ & (TELEMETRY_BUFFER_SIZE - 1)] = record->data[i];
+            }
+            // The thread sleeps while the buffer is empty. It has a lower
+            // priority than the callers, so no reschedule is needed.
+            if (was_empty && telemetry_thread) {
+                chEvtSignalI(telemetry_thread, EVENT_MASK(0));
+            }
+        }
+        else if (dropped < UINT16_MAX) {
+            dropped++;
+        }
+    }
+    chSysUnlock();
+}
+
+void telemetry_key_event(keyevent_t event) {
+    record_t record;
+    begin_record(&record, TELEMETRY_RECORD_KEY);
+    put32(&record, time_us());
+    put8(&record, event.key.row);
+    put8(&record, event.key.col);
+    put8(&record, event.pressed);
+    commit_record(&record);
+}
+
+void telemetry_visualizer_frame(uint8_t id, uint8_t frame, uint32_t duration_us) {
+    record_t record;
+    begin_record(&record, TELEMETRY_RECORD_VISUALIZER);
+    put32(&record, time_us());
+    put8(&record, id);
+    put8(&record, frame);
+    put32(&record, duration_us);
+    commit_record(&record);
+}
+
+static void record_stats(void) {
+    diagnostics_sample_t sample = diagnostics_sample(DIAGNOSTICS_TELEMETRY);
+    uint32_t now = time_us();
+    record_t record;
+    begin_record(&record, TELEMETRY_RECORD_SCAN);
+    put32(&record, now);
+    put32(&record, sample.scans_per_second);
+    put32(&record, sample.max_latency_us);
+    commit_record(&record);
+
+    begin_record(&record, TELEMETRY_RECORD_LINK);
+    put32(&record, now);
+    put8(&record, is_serial_link_connected());
+    put32(&record, sample.link_updates);
+    put32(&record, sample.max_link_gap_us);
+    commit_record(&record);
+}
+
+static void record_dropped(void) {
+    chSysLock();
+    uint16_t count = dropped;
+    dropped = 0;
+    chSysUnlock();
+    if (count == 0) {
+        return;
+    }
+    record_t record;
+    begin_record(&record, TELEMETRY_RECORD_DROPPED);
+    put32(&record, time_us());
+    put16(&record, count);
+    commit_record(&record);
+}
+
+#ifdef VISUALIZER_PROFILER_ENABLE
+// The ids are only meaningful with the names, so they are sent again whenever
+// the host might have restarted the decoder
+static void record_names(void) {
+    for (unsigned id = 0; id < 0x100; id++) {
+        const char* name = visualizer_profiler_name(id);
+        if (!name) {
+            continue;
+        }
+        record_t record;
+        begin_record(&record, TELEMETRY_RECORD_NAME);
+        put8(&record, id);
+        for (const char* c = name; *c && record.length < TELEMETRY_MAX_RECORD_SIZE; c++) {
+            put8(&record, *c);
+        }
+        commit_record(&record);
+    }
+}
+#endif
+
+static void in_cb(USBDriver* usbp, usbep_t ep) {
+    (void)usbp;
+    (void)ep;
+    chSysLockFromISR();
+    chEvtSignalI(telemetry_thread, EVENT_MASK(0));
+    chSysUnlockFromISR();
+}
+
+static USBInEndpointState ep_state;
+static const USBEndpointConfig ep_config = {
+    USB_EP_MODE_TYPE_INTR,          // Interrupt EP
+    NULL,                           // SETUP packet notification callback
+    in_cb,                          // IN notification callback
+    NULL,                           // OUT notification callback
+    TELEMETRY_EPSIZE,               // IN maximum packet size
+    0,                              // OUT maximum packet size
+    &ep_state,                      // IN Endpoint state
+    NULL,                           // OUT endpoint state
+    2,                              // IN multiplier
+    NULL                            // SETUP buffer (not a SETUP endpoint)
+};
+
+void telemetry_usb_configured(USBDriver* usbp, usbep_t ep) {
+    usb_driver = usbp;
+    endpoint = ep;
+    buffer_tail = buffer_head;
+    dropped = 0;
+    names_pending = true;
+    usbInitEndpointI(usbp, ep, &ep_config);
+    // The thread sleeps while there's no host
+    if (telemetry_thread) {
+        chEvtSignalI(telemetry_thread, EVENT_MASK(0));
+    }
+}
+
+// Fills the report with as many whole records as fit, returns false if there
+// aren't any. Called with the system locked.
+static bool fill_report(void) {
+    unsigned length = 0;
+    while (buffer_head != buffer_tail) {
+        uint8_t record_length = buffer[(buffer_tail + 1) & (TELEMETRY_BUFFER_SIZE - 1)];
+        if (length + record_length > TELEMETRY_REPORT_SIZE) {
+            break;
+        }
+        for (uint8_t i = 0; i < record_length; i++) {
+            report[length++] = buffer[buffer_tail++ & (TELEMETRY_BUFFER_SIZE - 1)];
+        }
+    }
+    memset(&report[length], TELEMETRY_RECORD_END, TELEMETRY_REPORT_SIZE - length);
+    return length > 0;
+}
+
+// Sends the next report if the previous one has been read, and either the
+// report is full, or the records have waited long enough
+static void send_report(bool flush) {
+    chSysLock();
+    if (!is_usb_active() || usbGetTransmitStatusI(usb_driver, endpoint)) {
+        chSysUnlock();
+        return;
+    }
+    if ((flush || buffer_head - buffer_tail >= TELEMETRY_REPORT_SIZE) && fill_report()) {
+        usbStartTransmitI(usb_driver, endpoint, report, TELEMETRY_REPORT_SIZE);
+    }
+    chSysUnlock();
+}
+
+// How long the thread can sleep. Without a host nothing is recorded, so it
+// sleeps until the USB is configured. With an empty buffer it only has to wake
+// up for the next statistics, otherwise for the next flush.
+static systime_t sleep_time(systime_t last_stats) {
+    chSysLock();
+    bool active = is_usb_active();
+    bool empty = buffer_head == buffer_tail;
+    chSysUnlock();
+    if (!active) {
+        return TIME_INFINITE;
+    }
+    if (!empty) {
+        return TELEMETRY_FLUSH_INTERVAL;
+    }
+    systime_t elapsed = chVTTimeElapsedSinceX(last_stats);
+    return elapsed < TELEMETRY_STATS_INTERVAL ? TELEMETRY_STATS_INTERVAL - elapsed : TIME_IMMEDIATE;
+}
+
+static THD_FUNCTION(telemetryThread, arg) {
+    (void)arg;
+    chRegSetThreadName("telemetry");
+    systime_t last_stats = chVTGetSystemTimeX();
+    systime_t last_flush = last_stats;
+    while (true) {
+        // Also woken up when a report has been read, so that a full buffer is
+        // sent as fast as the host polls, and when the first record goes into
+        // an empty buffer
+        systime_t timeout = sleep_time(last_stats);
+        if (timeout != TIME_IMMEDIATE) {
+            chEvtWaitAnyTimeout(ALL_EVENTS, timeout);
+        }
+        systime_t since_stats = chVTTimeElapsedSinceX(last_stats);
+        if (since_stats >= TELEMETRY_STATS_INTERVAL) {
+            // After a long sleep the statistics start again from now, instead
+            // of catching up with the missed intervals
+            last_stats = since_stats >= 2 * TELEMETRY_STATS_INTERVAL ?
+                chVTGetSystemTimeX() : last_stats + TELEMETRY_STATS_INTERVAL;
+            record_stats();
+        }
+#ifdef VISUALIZER_PROFILER_ENABLE
+        if (names_pending) {
+            names_pending = false;
+            record_names();
+        }
+#endif
+        record_dropped();
+        bool flush = chVTTimeElapsedSinceX(last_flush) >= TELEMETRY_FLUSH_INTERVAL;
+        if (flush) {
+            last_flush = chVTGetSystemTimeX();
+        }
+        send_report(flush);
+    }
+}
+
+void telemetry_init(void) {
+    telemetry_thread = chThdCreateStatic(waTelemetryThread, sizeof(waTelemetryThread),
+        TELEMETRY_THREAD_PRIORITY, telemetryThread, NULL);
+}
@@ -0,0 +1,47 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+#include "hal.h"
+#include "keyboard.h"
+#include "telemetry_format.h"
+
+// Streams compact binary records of the key events, the scan and link
+// statistics and the visualizer timings to the host, through a vendor defined
+// raw HID interface. The records are only copied into a buffer by the
+// callers, and sent by a low priority thread, so that nothing is formatted on
+// the keyboard thread. See telemetry/ for the host decoder.
+
+#define TELEMETRY_EPSIZE TELEMETRY_REPORT_SIZE
+// The polling interval of the telemetry endpoint in frames (ms)
+#define TELEMETRY_INTERVAL 1
+
+extern const USBDescriptor telemetry_report_descriptor;
+
+// Starts the sending thread
+void telemetry_init(void);
+// Called from the USB interrupt with the system locked, when the host has
+// selected the configuration
+void telemetry_usb_configured(USBDriver* usbp, usbep_t endpoint);
+
+void telemetry_key_event(keyevent_t event);
+void telemetry_visualizer_frame(uint8_t id, uint8_t frame, uint32_t duration_us);
+
+#endif /* TELEMETRY_H_ */
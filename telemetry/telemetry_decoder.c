@@ -0,0 +1,160 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Decodes the binary telemetry stream of the keyboard into text, one line per
+ * record.
+ *
+ * Usage: telemetry_decoder <device or file>
+ *
+ * On Linux the telemetry interface shows up as a /dev/hidraw device, which
+ * can be read directly. The input can also be a file of reports captured
+ * earlier, for example with cat, or - for the standard input.
+ *
+ * Each line starts with the time in milliseconds, followed by the record:
+ *   key <row> <column> down|up
+ *   scan <scans per second> <max latency us>
+ *   link connected|disconnected <updates> <max gap us>
+ *   visualizer <name> <frame> <duration us>
+ *   dropped <count>
+ * The names of the visualizer ids are sent by the keyboard when it's
+ * connected, the id is shown until then.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "telemetry_format.h"
+
+#define MAX_NAME_LENGTH TELEMETRY_MAX_RECORD_SIZE
+
+static char names[256][MAX_NAME_LENGTH];
+static uint64_t time_base = 0;
+static uint32_t last_time = 0;
+static bool time_seen = false;
+
+static uint32_t get16(const uint8_t* p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+// The times wrap around, so the wraps are counted to keep them increasing
+static double time_ms(uint32_t time) {
+    if (time_seen && time < last_time) {
+        time_base += 1ull << 32;
+    }
+    last_time = time;
+    time_seen = true;
+    return (time_base + time) / 1000.0;
+}
+
+static const char* name(uint8_t id) {
+    static char unnamed[8];
+    if (names[id][0]) {
+        return names[id];
+    }
+    snprintf(unnamed, sizeof(unnamed), "#%u", id);
+    return unnamed;
+}
+
+// Returns false if the record is shorter than its type needs
+static bool decode_record(const uint8_t* r, unsigned length) {
+    switch (r[0]) {
+    case TELEMETRY_RECORD_KEY:
+        if (length < 9) {
+            return false;
+        }
+        printf("%.2f key %u %u %s\n", time_ms(get32(r + 2)), r[6], r[7], r[8] ? "down" : "up");
+        break;
+    case TELEMETRY_RECORD_SCAN:
+        if (length < 14) {
+            return false;
+        }
+        printf("%.2f scan %u %u\n", time_ms(get32(r + 2)), get32(r + 6), get32(r + 10));
+        break;
+    case TELEMETRY_RECORD_LINK:
+        if (length < 15) {
+            return false;
+        }
+        printf("%.2f link %s %u %u\n", time_ms(get32(r + 2)),
+            r[6] ? "connected" : "disconnected", get32(r + 7), get32(r + 11));
+        break;
+    case TELEMETRY_RECORD_VISUALIZER:
+        if (length < 12) {
+            return false;
+        }
+        printf("%.2f visualizer %s %u %u\n", time_ms(get32(r + 2)), name(r[6]), r[7], get32(r + 8));
+        break;
+    case TELEMETRY_RECORD_DROPPED:
+        if (length < 8) {
+            return false;
+        }
+        printf("%.2f dropped %u\n", time_ms(get32(r + 2)), get16(r + 6));
+        break;
+    case TELEMETRY_RECORD_NAME: {
+        if (length < 3) {
+            return false;
+        }
+        unsigned name_length = length - 3;
+        if (name_length >= MAX_NAME_LENGTH) {
+            name_length = MAX_NAME_LENGTH - 1;
+        }
+        memcpy(names[r[2]], r + 3, name_length);
+        names[r[2]][name_length] = 0;
+        break;
+    }
+    default:
+        // Newer record types are skipped
+        break;
+    }
+    return true;
+}
+
+static void decode_report(const uint8_t* report) {
+    unsigned i = 0;
+    while (i + 2 <= TELEMETRY_REPORT_SIZE && report[i] != TELEMETRY_RECORD_END) {
+        unsigned length = report[i + 1];
+        if (length < 2 || i + length > TELEMETRY_REPORT_SIZE || !decode_record(&report[i], length)) {
+            fprintf(stderr, "Invalid record of type %u\n", report[i]);
+            return;
+        }
+        i += length;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <device or file>\n", argv[0]);
+        return 1;
+    }
+    FILE* f = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+    // The decoder is usually piped to other tools while the keyboard is used
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    uint8_t report[TELEMETRY_REPORT_SIZE];
+    while (fread(report, sizeof(report), 1, f) == 1) {
+        decode_report(report);
+    }
+    return 0;
+}
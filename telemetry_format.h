@@ -0,0 +1,57 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TELEMETRY_FORMAT_H_
+#define TELEMETRY_FORMAT_H_
+
+// The binary format of the telemetry stream, shared by the firmware and the
+// host decoder in telemetry/.
+//
+// The stream is sent as 64 byte input reports. Each report is filled with
+// whole records, and the rest is padded with zeros. A record starts with its
+// type and total length, so that a decoder can skip the types it doesn't
+// know. All values are little endian, and the times are in microseconds since
+// the keyboard was started, wrapping around after about 71 minutes.
+
+#define TELEMETRY_REPORT_SIZE 64
+#define TELEMETRY_MAX_RECORD_SIZE 24
+// The first id of the visualizer sections, the ids below are animations
+#define TELEMETRY_SECTION_ID 0x80
+
+typedef enum {
+    // Padding until the end of the report
+    TELEMETRY_RECORD_END = 0,
+    // uint32 time, uint8 row, uint8 column, uint8 pressed
+    TELEMETRY_RECORD_KEY = 1,
+    // uint32 time, uint32 scans per second, uint32 max key to report latency
+    // in us. Sent once per second.
+    TELEMETRY_RECORD_SCAN = 2,
+    // uint32 time, uint8 connected, uint32 matrix updates from the other half,
+    // uint32 longest gap between the updates in us. Sent once per second.
+    TELEMETRY_RECORD_LINK = 3,
+    // uint32 time, uint8 id, uint8 frame, uint32 duration in us. A frame of
+    // an animation, or a visualizer section like the LCD flush.
+    TELEMETRY_RECORD_VISUALIZER = 4,
+    // uint32 time, uint16 number of records lost since the last one, because
+    // the buffer was full
+    TELEMETRY_RECORD_DROPPED = 5,
+    // uint8 id, followed by the name, without a terminating zero. Sent for
+    // each visualizer id when the USB is configured.
+    TELEMETRY_RECORD_NAME = 6,
+} telemetry_record_type_t;
+
+#endif /* TELEMETRY_FORMAT_H_ */
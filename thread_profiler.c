@@ -0,0 +1,151 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "thread_profiler.h"
+#include "ch.h"
+#include "hal.h"
+#include "print.h"
+
+#define MAX_THREADS 16
+#define CYCLES_PER_MS (KINETIS_SYSCLK_FREQUENCY / 1000)
+#define CYCLES_PER_TICK (KINETIS_SYSCLK_FREQUENCY / CH_CFG_ST_FREQUENCY)
+
+// The stack fill value of the startup code, for the main thread and the
+// interrupt stacks
+#define CRT0_STACK_FILL_VALUE 0x55
+
+typedef struct {
+    const char* name;
+    tprio_t prio;
+    uint64_t cycles;
+    uint32_t stack_free;
+} thread_info_t;
+
+volatile uint32_t thread_profiler_irq_nesting = 0;
+volatile uint32_t thread_profiler_irq_start = 0;
+volatile uint32_t thread_profiler_irq_cycles = 0;
+
+// The interrupt time is counted separately, so it's taken away from the time
+// of the thread that was interrupted
+static uint32_t last_switch = 0;
+static uint32_t last_switch_irq_cycles = 0;
+static uint64_t irq_cycles = 0;
+// The cycle counter stops while the idle thread waits for an interrupt, so
+// the length of the window comes from the system time
+static systime_t window_start = 0;
+
+// The symbols of the linker script
+extern uint8_t __main_stack_base__[];
+extern uint8_t __main_stack_end__[];
+extern uint8_t __process_stack_base__[];
+extern uint8_t __process_stack_end__[];
+
+// Called from the context switch hook, with the system locked
+void thread_profiler_switch(thread_t* otp) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t irq = thread_profiler_irq_cycles;
+    otp->profile_cycles += (now - last_switch) - (irq - last_switch_irq_cycles);
+    irq_cycles += irq - last_switch_irq_cycles;
+    last_switch = now;
+    last_switch_irq_cycles = irq;
+}
+
+void thread_profiler_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    thread_profiler_reset();
+}
+
+void thread_profiler_reset(void) {
+    thread_t* tp = chRegFirstThread();
+    while (tp) {
+        chSysLock();
+        tp->profile_cycles = 0;
+        chSysUnlock();
+        tp = chRegNextThread(tp);
+    }
+    chSysLock();
+    // The current slice of this thread starts again from zero too
+    last_switch = DWT->CYCCNT;
+    last_switch_irq_cycles = thread_profiler_irq_cycles;
+    irq_cycles = 0;
+    window_start = chVTGetSystemTimeX();
+    chSysUnlock();
+}
+
+static uint32_t count_unused(const uint8_t* base, const uint8_t* end, uint8_t fill) {
+    const uint8_t* p = base;
+    while (p < end && *p == fill) {
+        p++;
+    }
+    return p - base;
+}
+
+// The thread structure is at the start of the working area, and the stack
+// grows down towards it, so the bytes right after it are the last to be used.
+// The main thread runs on the process stack of the startup code.
+static uint32_t stack_free(thread_t* tp) {
+    if (tp == &ch.mainthread) {
+        return count_unused(__process_stack_base__, __process_stack_end__, CRT0_STACK_FILL_VALUE);
+    }
+    const uint8_t* base = (const uint8_t*)(tp + 1);
+    return count_unused(base, (const uint8_t*)tp->p_ctx.r13, CH_DBG_STACK_FILL_VALUE);
+}
+
+static unsigned permille(uint64_t part, uint64_t total) {
+    return total ? (unsigned)(part * 1000 / total) : 0;
+}
+
+void thread_profiler_print(void) {
+    static thread_info_t threads[MAX_THREADS];
+    unsigned num_threads = 0;
+    // The time of the printing thread is added up to now
+    chSysLock();
+    thread_profiler_switch(chThdGetSelfX());
+    uint64_t window = (uint64_t)(systime_t)(chVTGetSystemTimeX() - window_start) * CYCLES_PER_TICK;
+    uint64_t irq = irq_cycles;
+    chSysUnlock();
+
+    uint64_t awake = irq;
+    thread_t* tp = chRegFirstThread();
+    while (tp) {
+        if (num_threads < MAX_THREADS) {
+            thread_info_t* info = &threads[num_threads++];
+            chSysLock();
+            info->name = tp->p_name ? tp->p_name : "unnamed";
+            info->prio = tp->p_prio;
+            info->cycles = tp->profile_cycles;
+            chSysUnlock();
+            awake += info->cycles;
+            info->stack_free = stack_free(tp);
+        }
+        tp = chRegNextThread(tp);
+    }
+
+    xprintf("\nThreads, %u ms\n", (unsigned)(window / CYCLES_PER_MS));
+    xprintf("%12s %4s %6s %6s\n", "", "prio", "cpu %", "free");
+    for (unsigned i = 0; i < num_threads; i++) {
+        unsigned cpu = permille(threads[i].cycles, window);
+        xprintf("%12s %4u %4u.%u %6u\n", threads[i].name, (unsigned)threads[i].prio,
+            cpu / 10, cpu % 10, (unsigned)threads[i].stack_free);
+    }
+    unsigned cpu = permille(irq, window);
+    xprintf("%12s %4s %4u.%u %6u\n", "interrupts", "", cpu / 10, cpu % 10,
+        (unsigned)count_unused(__main_stack_base__, __main_stack_end__, CRT0_STACK_FILL_VALUE));
+    cpu = permille(window > awake ? window - awake : 0, window);
+    xprintf("%12s %4s %4u.%u\n", "sleeping", "", cpu / 10, cpu % 10);
+}
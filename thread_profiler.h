@@ -0,0 +1,30 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_PROFILER_H_
+#define THREAD_PROFILER_H_
+
+// Measures how the CPU time is shared between the threads and the
+// interrupts, and how much of each stack has been used. The CPU cycles are
+// counted in the context switch and interrupt hooks of chconf.h. The results
+// are printed with the "R" console command.
+
+void thread_profiler_init(void);
+void thread_profiler_print(void);
+void thread_profiler_reset(void);
+
+#endif /* THREAD_PROFILER_H_ */
@@ -0,0 +1,120 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdarg.h>
+#include "trace.h"
+#include "ch.h"
+
+// The number of records must be a power of two
+#define TRACE_BUFFER_RECORDS 64
+#define TRACE_THREAD_PRIORITY LOWPRIO
+
+// A record is reserved by moving the head forward, and published by writing
+// its sequence number last. The formatting thread reads the records in order,
+// and waits at a record that hasn't been published yet. A record is only
+// reused after the tail has moved past it. The thread sleeps until a record
+// is published.
+typedef struct {
+    const char* format;
+    systime_t time;
+    uint32_t args[TRACE_MAX_ARGS];
+    uint32_t sequence;
+} trace_record_t;
+
+static trace_record_t records[TRACE_BUFFER_RECORDS];
+static uint32_t head = 0;
+static uint32_t tail = 0;
+static uint32_t dropped = 0;
+
+static thread_t* trace_thread = NULL;
+static THD_WORKING_AREA(waTraceThread, 256);
+
+void trace_record(const char* format, unsigned count, ...) {
+    systime_t time = chVTGetSystemTimeX();
+    uint32_t index = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    do {
+        if (index - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= TRACE_BUFFER_RECORDS) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&head, &index, index + 1, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    trace_record_t* record = &records[index & (TRACE_BUFFER_RECORDS - 1)];
+    record->format = format;
+    record->time = time;
+    va_list args;
+    va_start(args, count);
+    // All the supported argument types are passed as 32 bit words
+    for (unsigned i = 0; i < TRACE_MAX_ARGS; i++) {
+        record->args[i] = i < count ? va_arg(args, uint32_t) : 0;
+    }
+    va_end(args);
+    __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+
+    // This works from both threads and interrupts, and with the system
+    // already locked
+    if (trace_thread) {
+        syssts_t status = chSysGetStatusAndLockX();
+        chEvtSignalI(trace_thread, EVENT_MASK(0));
+        chSysRestoreStatusX(status);
+    }
+}
+
+// ST2MS overflows 32 bits after about 7 minutes at 10 kHz
+#define TICKS_TO_MS(n) ((uint32_t)((uint64_t)(n) * 1000 / CH_CFG_ST_FREQUENCY))
+
+// The time in milliseconds goes in front of the line, after the empty lines
+// that some of the outputs start with
+static void print_record(const trace_record_t* record) {
+    const char* format = record->format;
+    while (*format == '\n') {
+        xprintf("\n");
+        format++;
+    }
+    xprintf("%u ", (unsigned)TICKS_TO_MS(record->time));
+    xprintf(format, record->args[0], record->args[1], record->args[2], record->args[3]);
+}
+
+static THD_FUNCTION(traceThread, arg) {
+    (void)arg;
+    chRegSetThreadName("trace");
+    while (true) {
+        // The records of the previous wakeup are all printed, so a record
+        // that is published in the meantime leaves the event pending
+        chEvtWaitAny(ALL_EVENTS);
+        uint32_t count = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+        if (count) {
+            xprintf("trace: %u dropped\n", (unsigned)count);
+        }
+        while (true) {
+            const trace_record_t* record = &records[tail & (TRACE_BUFFER_RECORDS - 1)];
+            if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != tail + 1) {
+                break;
+            }
+            print_record(record);
+            __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+void trace_init(void) {
+    trace_thread = chThdCreateStatic(waTraceThread, sizeof(waTraceThread),
+        TRACE_THREAD_PRIORITY, traceThread, NULL);
+    // For the records from before the thread existed
+    chEvtSignal(trace_thread, EVENT_MASK(0));
+}
@@ -0,0 +1,53 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+#include "print.h"
+
+// Debug output that is formatted later. TRACE takes an xprintf format and up
+// to four integer, character or pointer arguments, and only stores them with
+// a timestamp in a lock free ring buffer, so it can be called from any thread
+// or interrupt that may use the kernel, without changing the timing. A low
+// priority thread, which sleeps until there's something to print, formats the
+// records to the console. The format, and the strings passed to %s, must
+// stay valid until then, so they should be constants.
+//
+// Without TRACE_ENABLE the output is formatted immediately with xprintf.
+
+#define TRACE_MAX_ARGS 4
+
+#ifdef TRACE_ENABLE
+
+#define TRACE_COUNT_ARGS(...) TRACE_COUNT_ARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define TRACE_COUNT_ARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define TRACE(format, ...) \
+    trace_record(format, TRACE_COUNT_ARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+// Starts the formatting thread
+void trace_init(void);
+void trace_record(const char* format, unsigned count, ...);
+
+#else
+
+#define TRACE(...) xprintf(__VA_ARGS__)
+
+#endif
+
+#endif /* TRACE_H_ */
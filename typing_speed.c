@@ -0,0 +1,68 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "typing_speed.h"
+
+#if (TYPING_SPEED_HISTORY & (TYPING_SPEED_HISTORY - 1)) != 0
+#error TYPING_SPEED_HISTORY must be a power of two
+#endif
+
+// Only the keyboard thread writes, so the count only needs to be published
+// after the time it refers to has been stored
+static systime_t press_times[TYPING_SPEED_HISTORY];
+static uint32_t num_presses = 0;
+
+void typing_speed_record_press(void) {
+    uint32_t n = num_presses;
+    press_times[n & (TYPING_SPEED_HISTORY - 1)] = chVTGetSystemTimeX();
+    __atomic_store_n(&num_presses, n + 1, __ATOMIC_RELEASE);
+}
+
+static uint16_t rate(uint64_t scaled_count, uint64_t period) {
+    uint64_t value = (scaled_count + period / 2) / period;
+    return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+typing_speed_t typing_speed_get(void) {
+    typing_speed_t speed = {0, 0};
+    uint32_t n = __atomic_load_n(&num_presses, __ATOMIC_ACQUIRE);
+    systime_t now = chVTGetSystemTimeX();
+    uint32_t max_count = n < TYPING_SPEED_HISTORY ? n : TYPING_SPEED_HISTORY;
+    uint32_t count = 0;
+    systime_t oldest = 0;
+    // Count the presses inside the window, starting from the newest
+    while (count < max_count) {
+        systime_t age = now - press_times[(n - 1 - count) & (TYPING_SPEED_HISTORY - 1)];
+        if (age >= TYPING_SPEED_WINDOW) {
+            break;
+        }
+        oldest = age;
+        count++;
+    }
+    if (count == 0) {
+        return speed;
+    }
+    // When typing fast enough to fill the history, the speed is averaged
+    // over the remembered presses instead of the whole window
+    uint64_t period = count == TYPING_SPEED_HISTORY ? oldest : TYPING_SPEED_WINDOW;
+    if (period == 0) {
+        period = 1;
+    }
+    speed.keys_per_second_x10 = rate((uint64_t)count * 10 * CH_CFG_ST_FREQUENCY, period);
+    speed.wpm = rate((uint64_t)count * 60 * CH_CFG_ST_FREQUENCY / 5, period);
+    return speed;
+}
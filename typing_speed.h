@@ -0,0 +1,45 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TYPING_SPEED_H_
+#define TYPING_SPEED_H_
+
+#include <stdint.h>
+#include "ch.h"
+
+// Measures the typing speed from the times of the last key presses. Recording
+// a press only stores the time, the speed is calculated by the visualizer
+// thread when it's needed.
+
+// The number of presses that are remembered, must be a power of two
+#define TYPING_SPEED_HISTORY 128
+// The speed is averaged over this period
+#define TYPING_SPEED_WINDOW S2ST(10)
+
+typedef struct {
+    // Keystrokes per second, times 10
+    uint16_t keys_per_second_x10;
+    // Words per minute, with five keystrokes per word
+    uint16_t wpm;
+} typing_speed_t;
+
+// Called by the keyboard thread for every debounced key press
+void typing_speed_record_press(void);
+// Calculates the speed at the current time
+typing_speed_t typing_speed_get(void);
+
+#endif /* TYPING_SPEED_H_ */
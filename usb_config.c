@@ -0,0 +1,227 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "usb_config.h"
+#include "usb_main.h"
+#include "report_filter.h"
+#ifdef USB_SYNC_ENABLE
+#include "usb_sync.h"
+#endif
+#ifdef TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
+
+#define MAX_CONFIG_DESCRIPTOR_SIZE 256
+// How long the bus stays disconnected while the configuration is replaced,
+// the same as the attach debounce time of the host
+#define USB_CONFIG_DISCONNECT_TIME 100
+
+static const USBConfig* original_config = NULL;
+static USBConfig config;
+// The configuration descriptor is patched once when the configuration is
+// replaced, and served from here after that
+static uint8_t config_descriptor_data[MAX_CONFIG_DESCRIPTOR_SIZE];
+static USBDescriptor config_descriptor;
+
+#ifdef TELEMETRY_ENABLE
+// The telemetry interface is appended after the interfaces of tmk_core, and
+// gets the next free interface and endpoint numbers
+#define TELEMETRY_HID_DESCRIPTOR_OFFSET 9
+#define TELEMETRY_ENDPOINT_OFFSET 18
+
+static const uint8_t telemetry_interface_descriptor[] = {
+    USB_DESC_INTERFACE(0,       // bInterfaceNumber, patched
+                       0,       // bAlternateSetting
+                       1,       // bNumEndpoints
+                       0x03,    // bInterfaceClass (HID)
+                       0x00,    // bInterfaceSubClass (no boot)
+                       0x00,    // bInterfaceProtocol
+                       0),      // iInterface
+    // HID descriptor, the report descriptor length is patched
+    USB_DESC_BYTE(9),           // bLength
+    USB_DESC_BYTE(0x21),        // bDescriptorType (HID)
+    USB_DESC_BCD(0x0111),       // bcdHID
+    USB_DESC_BYTE(0),           // bCountryCode
+    USB_DESC_BYTE(1),           // bNumDescriptors
+    USB_DESC_BYTE(0x22),        // bDescriptorType (report)
+    USB_DESC_WORD(0),           // wDescriptorLength
+    USB_DESC_ENDPOINT(0x80,     // bEndpointAddress, patched
+                      0x03,     // bmAttributes (interrupt)
+                      TELEMETRY_EPSIZE,
+                      TELEMETRY_INTERVAL),
+};
+
+static uint8_t telemetry_interface = 0;
+static usbep_t telemetry_endpoint = 0;
+static USBDescriptor telemetry_hid_descriptor;
+#endif
+
+#ifdef USB_SYNC_ENABLE
+static bool is_keyboard_endpoint(uint8_t address) {
+#ifdef NKRO_ENABLE
+    if (address == (NKRO_ENDPOINT | 0x80)) {
+        return true;
+    }
+#endif
+    return address == (KBD_ENDPOINT | 0x80);
+}
+#endif
+
+#ifdef TELEMETRY_ENABLE
+static size_t add_telemetry_interface(size_t size, uint8_t max_endpoint) {
+    if (size + sizeof(telemetry_interface_descriptor) > sizeof(config_descriptor_data) ||
+            max_endpoint >= USB_MAX_ENDPOINTS) {
+        return size;
+    }
+    uint8_t* d = &config_descriptor_data[size];
+    memcpy(d, telemetry_interface_descriptor, sizeof(telemetry_interface_descriptor));
+    telemetry_interface = config_descriptor_data[4]++;
+    telemetry_endpoint = max_endpoint + 1;
+    d[2] = telemetry_interface;
+    d[TELEMETRY_HID_DESCRIPTOR_OFFSET + 7] = telemetry_report_descriptor.ud_size & 0xFF;
+    d[TELEMETRY_HID_DESCRIPTOR_OFFSET + 8] = telemetry_report_descriptor.ud_size >> 8;
+    d[TELEMETRY_ENDPOINT_OFFSET + 2] = telemetry_endpoint | 0x80;
+    telemetry_hid_descriptor.ud_size = 9;
+    telemetry_hid_descriptor.ud_string = &d[TELEMETRY_HID_DESCRIPTOR_OFFSET];
+    size += sizeof(telemetry_interface_descriptor);
+    config_descriptor_data[2] = size & 0xFF;
+    config_descriptor_data[3] = size >> 8;
+    return size;
+}
+#endif
+
+static void patch_config_descriptor(USBDriver* usbp) {
+    const USBDescriptor* descriptor = original_config->get_descriptor_cb(usbp, USB_DESCRIPTOR_CONFIGURATION, 0, 0);
+    if (descriptor == NULL || descriptor->ud_size > sizeof(config_descriptor_data)) {
+        return;
+    }
+    size_t size = descriptor->ud_size;
+    memcpy(config_descriptor_data, descriptor->ud_string, size);
+    uint8_t max_endpoint = 0;
+    // Each descriptor starts with its length and type, the interval is the
+    // last byte of an endpoint descriptor
+    for (size_t i = 0; i + 7 <= size && config_descriptor_data[i] >= 2; i += config_descriptor_data[i]) {
+        uint8_t* d = &config_descriptor_data[i];
+        if (d[1] != USB_DESCRIPTOR_ENDPOINT) {
+            continue;
+        }
+        if ((d[2] & 0x7F) > max_endpoint) {
+            max_endpoint = d[2] & 0x7F;
+        }
+#ifdef USB_SYNC_ENABLE
+        if (is_keyboard_endpoint(d[2])) {
+            d[6] = USB_SYNC_INTERVAL;
+        }
+#endif
+    }
+#ifdef TELEMETRY_ENABLE
+    size = add_telemetry_interface(size, max_endpoint);
+#else
+    (void)max_endpoint;
+#endif
+    config_descriptor.ud_size = size;
+    config_descriptor.ud_string = config_descriptor_data;
+}
+
+static const USBDescriptor* get_descriptor(USBDriver* usbp, uint8_t dtype, uint8_t dindex, uint16_t lang) {
+#ifdef TELEMETRY_ENABLE
+    // The HID class descriptors are requested from the interface
+    if (telemetry_endpoint && lang == telemetry_interface) {
+        if (dtype == 0x21) {
+            return &telemetry_hid_descriptor;
+        }
+        if (dtype == 0x22) {
+            return &telemetry_report_descriptor;
+        }
+    }
+#endif
+    if (dtype == USB_DESCRIPTOR_CONFIGURATION && config_descriptor.ud_string) {
+        return &config_descriptor;
+    }
+    return original_config->get_descriptor_cb(usbp, dtype, dindex, lang);
+}
+
+static bool requests_hook(USBDriver* usbp) {
+#ifdef TELEMETRY_ENABLE
+    const uint8_t* setup = usbp->setup;
+    if (telemetry_endpoint &&
+            (setup[0] & (USB_RTYPE_TYPE_MASK | USB_RTYPE_RECIPIENT_MASK)) ==
+            (USB_RTYPE_TYPE_CLASS | USB_RTYPE_RECIPIENT_INTERFACE) &&
+            setup[4] == telemetry_interface) {
+        // There are no output or feature reports, so SET_IDLE and the other
+        // host to device requests are accepted and ignored
+        if ((setup[0] & USB_RTYPE_DIR_MASK) == USB_RTYPE_DIR_HOST2DEV) {
+            usbSetupTransfer(usbp, NULL, 0, NULL);
+            return true;
+        }
+        return false;
+    }
+#endif
+    if (original_config->requests_hook_cb) {
+        return original_config->requests_hook_cb(usbp);
+    }
+    return false;
+}
+
+static void event_cb(USBDriver* usbp, usbevent_t event) {
+    if (original_config->event_cb) {
+        original_config->event_cb(usbp, event);
+    }
+    if (event == USB_EVENT_RESET || event == USB_EVENT_SUSPEND) {
+        report_filter_usb_reset();
+    }
+#ifdef TELEMETRY_ENABLE
+    if (event == USB_EVENT_CONFIGURED && telemetry_endpoint) {
+        chSysLockFromISR();
+        telemetry_usb_configured(usbp, telemetry_endpoint);
+        chSysUnlockFromISR();
+    }
+#endif
+}
+
+static void sof_cb(USBDriver* usbp) {
+#ifdef USB_SYNC_ENABLE
+    usb_sync_sof();
+#endif
+    if (original_config->sof_cb) {
+        original_config->sof_cb(usbp);
+    }
+}
+
+void usb_config_init(USBDriver* usbp) {
+    if (original_config) {
+        return;
+    }
+    // tmk_core has already started the driver and connected the bus, so the
+    // host might be reading the original descriptors. Replacing the
+    // configuration of a running driver would race with that, so the driver
+    // is restarted with the copy while the bus is disconnected, and the host
+    // enumerates the device again from the start.
+    usbDisconnectBus(usbp);
+    original_config = usbp->config;
+    config = *original_config;
+    config.event_cb = event_cb;
+    config.get_descriptor_cb = get_descriptor;
+    config.requests_hook_cb = requests_hook;
+    config.sof_cb = sof_cb;
+    patch_config_descriptor(usbp);
+    usbStop(usbp);
+    chThdSleepMilliseconds(USB_CONFIG_DISCONNECT_TIME);
+    usbStart(usbp, &config);
+    usbConnectBus(usbp);
+}
@@ -0,0 +1,34 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef USB_CONFIG_H_
+#define USB_CONFIG_H_
+
+#include "hal.h"
+
+// The USB configuration and the descriptors belong to tmk_core. This replaces
+// the configuration of the driver with a copy, where the callbacks are wrapped
+// so that the keyboard can change the descriptors and follow the USB events.
+// Without USB_SYNC_ENABLE or TELEMETRY_ENABLE the copy behaves exactly like
+// the original.
+
+// Must be called after tmk_core has started the USB driver. The driver is
+// restarted with the new configuration, and the bus is reconnected, so that
+// the host enumerates the device with the new descriptors
+void usb_config_init(USBDriver* usbp);
+
+#endif /* USB_CONFIG_H_ */
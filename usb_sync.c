@@ -0,0 +1,160 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "usb_sync.h"
+#include "usb_main.h"
+#include "print.h"
+#include "pit_timer.h"
+
+// The polling interval of the keyboard endpoints is changed by usb_config.c,
+// which also forwards the start of frame interrupts here
+
+// The times are measured with the PIT counter, since the cycle counter of the
+// core stops while the idle thread waits for an interrupt
+#define CYCLES_PER_US PIT_TIMER_CYCLES_PER_US
+#define FRAME_CYCLES (PIT_TIMER_FREQUENCY / 1000)
+// Shorter waits are not worth the context switches
+#define MIN_WAIT_US 10
+
+typedef struct {
+    uint32_t reports;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} report_stats_t;
+
+static volatile uint32_t sof_cycles = 0;
+static volatile bool sof_seen = false;
+static uint32_t loop_start = 0;
+static uint32_t scan_cycles = 0;
+static report_stats_t report_stats;
+
+static host_driver_t* wrapped_driver = NULL;
+
+void usb_sync_sof(void) {
+    sof_cycles = pit_timer_now();
+    sof_seen = true;
+}
+
+static bool is_synced(uint32_t now) {
+    return USB_DRIVER.state == USB_ACTIVE && sof_seen && now - sof_cycles < 2 * FRAME_CYCLES;
+}
+
+// The scan time is followed quickly when it grows, and slowly when it shrinks
+static void update_scan_time(uint32_t cycles) {
+    if (cycles > FRAME_CYCLES) {
+        cycles = FRAME_CYCLES;
+    }
+    if (cycles > scan_cycles) {
+        scan_cycles = cycles;
+    }
+    else {
+        scan_cycles -= (scan_cycles - cycles) / 64;
+    }
+}
+
+void usb_sync_wait(void) {
+    uint32_t now = pit_timer_now();
+    update_scan_time(now - loop_start);
+    if (is_synced(now)) {
+        uint32_t lead = scan_cycles + USB_SYNC_MARGIN_US * CYCLES_PER_US;
+        // The time until the next scan has to start, to be done before the
+        // next start of frame. If that's already too late, the scan is moved
+        // to the following frame.
+        uint32_t since_sof = (now - sof_cycles) % FRAME_CYCLES;
+        int32_t wait = (int32_t)(FRAME_CYCLES - lead) - (int32_t)since_sof;
+        if (wait < 0) {
+            wait += FRAME_CYCLES;
+        }
+        if (wait >= (int32_t)(MIN_WAIT_US * CYCLES_PER_US)) {
+            pit_timer_sleep_us(wait / CYCLES_PER_US);
+        }
+    }
+    loop_start = pit_timer_now();
+}
+
+static void send_keyboard(report_keyboard_t* report) {
+    wrapped_driver->send_keyboard(report);
+    uint32_t now = pit_timer_now();
+    if (!is_synced(now)) {
+        return;
+    }
+    // The time left until the next start of frame, when the host can poll
+    // the report
+    uint32_t since_sof = now - sof_cycles;
+    uint32_t to_sof = since_sof < FRAME_CYCLES ? FRAME_CYCLES - since_sof : 0;
+    chSysLock();
+    report_stats_t* s = &report_stats;
+    if (s->reports == 0 || to_sof < s->min) {
+        s->min = to_sof;
+    }
+    if (to_sof > s->max) {
+        s->max = to_sof;
+    }
+    s->reports++;
+    s->total += to_sof;
+    chSysUnlock();
+}
+
+static uint8_t keyboard_leds(void) {
+    return wrapped_driver->keyboard_leds();
+}
+
+static void send_mouse(report_mouse_t* report) {
+    wrapped_driver->send_mouse(report);
+}
+
+static void send_system(uint16_t data) {
+    wrapped_driver->send_system(data);
+}
+
+static void send_consumer(uint16_t data) {
+    wrapped_driver->send_consumer(data);
+}
+
+static host_driver_t usb_sync_driver = {
+    keyboard_leds,
+    send_keyboard,
+    send_mouse,
+    send_system,
+    send_consumer,
+};
+
+host_driver_t* usb_sync_wrap_driver(host_driver_t* driver) {
+    wrapped_driver = driver;
+    return &usb_sync_driver;
+}
+
+void usb_sync_print(void) {
+    chSysLock();
+    report_stats_t s = report_stats;
+    uint32_t scan = scan_cycles;
+    chSysUnlock();
+    uint32_t avg = s.reports ? s.total / s.reports : 0;
+    xprintf("\nReport to start of frame (us)\n");
+    xprintf("reports %u min %u avg %u max %u\n", (unsigned)s.reports,
+        (unsigned)(s.min / CYCLES_PER_US), (unsigned)(avg / CYCLES_PER_US),
+        (unsigned)(s.max / CYCLES_PER_US));
+    xprintf("scan %u us, interval %u ms\n", (unsigned)(scan / CYCLES_PER_US), USB_SYNC_INTERVAL);
+}
+
+void usb_sync_reset(void) {
+    chSysLock();
+    memset(&report_stats, 0, sizeof(report_stats));
+    chSysUnlock();
+}
@@ -0,0 +1,46 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef USB_SYNC_H_
+#define USB_SYNC_H_
+
+#include "ch.h"
+#include "hal.h"
+#include "host_driver.h"
+
+// High rate mode, the keyboard endpoints are polled every frame, and the
+// matrix scans are timed so that they finish just before the start of the next
+// USB frame. The time from each keyboard report to the next start of frame is
+// measured, and printed with the "O" console command.
+
+// The polling interval of the keyboard endpoints in frames (ms)
+#define USB_SYNC_INTERVAL 1
+// Extra time on top of the measured scan time, so that the report isn't late
+// because of the wake up latency or an interrupt
+#define USB_SYNC_MARGIN_US 50
+
+// Called from the start of frame interrupt
+void usb_sync_sof(void);
+// Returns a host driver that measures the reports sent through the given one
+host_driver_t* usb_sync_wrap_driver(host_driver_t* driver);
+// Called at the end of each keyboard loop, sleeps until it's time to start
+// the next scan
+void usb_sync_wait(void);
+void usb_sync_print(void);
+void usb_sync_reset(void);
+
+#endif /* USB_SYNC_H_ */
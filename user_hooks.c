@@ -23,19 +23,150 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "usb_main.h"
 #include "suspend.h"
 #include "serial_link/system/serial_link.h"
+#include "command.h"
+#include "keycode.h"
+#include "typing_speed.h"
+#include "key_heatmap.h"
+#include "diagnostics.h"
+#include "report_filter.h"
+#include "usb_config.h"
+#include "trace.h"
+#include "pit_timer.h"
+#ifdef TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
+#ifdef USB_SYNC_ENABLE
+#include "usb_sync.h"
+#endif
+#ifdef VISUALIZER_PROFILER_ENABLE
+#include "visualizer_profiler.h"
+#endif
+#ifdef THREAD_PROFILER_ENABLE
+#include "thread_profiler.h"
+#endif
+#ifdef LCD_BACKLIGHT_ENABLE
+#include "lcd_backlight_pipeline.h"
+
+// The backlight switches to the low power PWM profile when no keys have been
+// pressed for this long. Each half only sees its own keys, but since the
+// profiles look the same, that doesn't matter.
+#define BACKLIGHT_IDLE_TIMEOUT S2ST(30)
+
+static systime_t last_activity = 0;
+static bool backlight_idle = false;
+
+static void update_backlight_idle(void) {
+    if (!backlight_idle && chVTTimeElapsedSinceX(last_activity) >= BACKLIGHT_IDLE_TIMEOUT) {
+        backlight_idle = true;
+        lcd_backlight_hal_set_profile(LCD_BACKLIGHT_PROFILE_LOW_POWER);
+    }
+}
+
+static void wake_backlight(void) {
+    last_activity = chVTGetSystemTimeX();
+    if (backlight_idle) {
+        backlight_idle = false;
+        lcd_backlight_hal_set_profile(LCD_BACKLIGHT_PROFILE_NORMAL);
+    }
+}
+#endif
+
+void hook_matrix_change(keyevent_t event) {
+    diagnostics_matrix_change();
+#ifdef LCD_BACKLIGHT_ENABLE
+    wake_backlight();
+#endif
+    // Only the time and the count are stored here, so that the key press isn't
+    // delayed
+    if (event.pressed) {
+        typing_speed_record_press();
+        key_heatmap_record(event.key);
+    }
+#ifdef TELEMETRY_ENABLE
+    telemetry_key_event(event);
+#endif
+}
+
+// The inputs of the last visualizer_update call. The sequence is incremented
+// whenever the visualizer needs an update that doesn't show in the layers or
+// LEDs, like after a wakeup. It's only written by the keyboard thread, but uses
+// an atomic increment so that the other hooks can bump it without locking.
+typedef struct {
+    uint32_t default_layer;
+    uint32_t layer;
+    uint32_t leds;
+    uint32_t sequence;
+} visualizer_input_t;
+
+static volatile uint32_t visualizer_sequence = 1;
+static visualizer_input_t last_visualizer_input;
+static systime_t last_visualizer_update = 0;
+
+// While the serial link is connected, visualizer_update is also what sends the
+// state from the master to the slave, and what picks it up on the slave. So
+// it's called at this interval even when nothing has changed, which also
+// repeats the state for a slave that connects late or misses an update. The
+// visualizer itself resends the state at most every 10 ms.
+#define VISUALIZER_LINK_INTERVAL MS2ST(10)
+
+static void invalidate_visualizer_input(void) {
+    __atomic_add_fetch(&visualizer_sequence, 1, __ATOMIC_RELAXED);
+}
+
+// Calls visualizer_update only when the input has changed, or at the link
+// interval while the serial link is connected, so that the visualizer isn't
+// locked and signaled on every loop iteration
+static void update_visualizer(void) {
+    visualizer_input_t input = {
+        .default_layer = default_layer_state,
+        .layer = layer_state,
+        .leds = host_keyboard_leds(),
+        .sequence = __atomic_load_n(&visualizer_sequence, __ATOMIC_RELAXED),
+    };
+    bool unchanged = input.default_layer == last_visualizer_input.default_layer &&
+        input.layer == last_visualizer_input.layer &&
+        input.leds == last_visualizer_input.leds &&
+        input.sequence == last_visualizer_input.sequence;
+    if (unchanged && (!is_serial_link_connected() ||
+            chVTTimeElapsedSinceX(last_visualizer_update) < VISUALIZER_LINK_INTERVAL)) {
+        return;
+    }
+    last_visualizer_input = input;
+    last_visualizer_update = chVTGetSystemTimeX();
+    visualizer_update(input.default_layer, input.layer, input.leds);
+}
 
 void hook_early_init(void) {
+    pit_timer_init();
+#ifdef THREAD_PROFILER_ENABLE
+    thread_profiler_init();
+#endif
+#ifdef TRACE_ENABLE
+    trace_init();
+#endif
     init_serial_link();
+    key_heatmap_init();
+#ifdef TELEMETRY_ENABLE
+    telemetry_init();
+#endif
     visualizer_init();
 }
 
 host_driver_t* hook_keyboard_connect(host_driver_t* default_driver) {
+    // Restarts the USB driver with the patched descriptors
+    usb_config_init(&USB_DRIVER);
+#ifdef USB_SYNC_ENABLE
+    default_driver = usb_sync_wrap_driver(default_driver);
+#endif
     while (true) {
         if(USB_DRIVER.state == USB_ACTIVE) {
-            return default_driver;
+            TRACE("connected to USB\n");
+            // The unchanged reports are dropped before they are measured
+            return report_filter_wrap_driver(diagnostics_wrap_driver(default_driver));
         }
         if(is_serial_link_connected()) {
-            return get_serial_link_driver();
+            TRACE("connected to the serial link\n");
+            return diagnostics_wrap_driver(get_serial_link_driver());
         }
         serial_link_update();
         chThdSleepMilliseconds(50);
@@ -43,21 +174,39 @@ host_driver_t* hook_keyboard_connect(host_driver_t* default_driver) {
 }
 
 void hook_keyboard_loop(void) {
+    diagnostics_loop_end();
     serial_link_update();
-    visualizer_update(default_layer_state, layer_state, host_keyboard_leds());
+    update_visualizer();
+#ifdef LCD_BACKLIGHT_ENABLE
+    update_backlight_idle();
+#endif
+#ifdef USB_SYNC_ENABLE
+    usb_sync_wait();
+#endif
 }
 
 void hook_usb_suspend_entry(void) {
+    TRACE("suspend\n");
+    // The keyboard might lose power while suspended
+    key_heatmap_request_flush();
+    invalidate_visualizer_input();
     visualizer_suspend();
 }
 
 void hook_usb_wakeup(void) {
+    TRACE("wakeup\n");
+#ifdef LCD_BACKLIGHT_ENABLE
+    // The resume animation selects the normal profile
+    last_activity = chVTGetSystemTimeX();
+    backlight_idle = false;
+#endif
+    invalidate_visualizer_input();
     visualizer_resume();
 }
 
 void hook_usb_suspend_loop(void) {
     serial_link_update();
-    visualizer_update(default_layer_state, layer_state, host_keyboard_leds());
+    update_visualizer();
     /* Do this in the suspended state */
     suspend_power_down(); // on AVR this deep sleeps for 15ms
     /* Remote wakeup */
@@ -66,3 +215,37 @@ void hook_usb_suspend_loop(void) {
     }
 }
 
+// Keyboard specific console commands, these are checked before the common ones
+bool command_extra(uint8_t code) {
+    switch (code) {
+#ifdef VISUALIZER_PROFILER_ENABLE
+    case KC_I:
+        visualizer_profiler_print();
+        // The next print starts from a clean profile
+        visualizer_profiler_reset();
+        return true;
+#endif
+    case KC_U:
+        key_heatmap_print();
+        return true;
+#ifdef USB_SYNC_ENABLE
+    case KC_O:
+        usb_sync_print();
+        usb_sync_reset();
+        return true;
+#endif
+#ifdef THREAD_PROFILER_ENABLE
+    case KC_R:
+        thread_profiler_print();
+        thread_profiler_reset();
+        return true;
+#endif
+    case KC_G:
+        // Also works without a console, the graph replaces the LCD animation
+        diagnostics_toggle_graph();
+        invalidate_visualizer_input();
+        return true;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,205 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include "visualizer_profiler.h"
+#include "pit_timer.h"
+#include "print.h"
+#ifdef TELEMETRY_ENABLE
+#include "telemetry.h"
+#endif
+
+typedef struct {
+    uint32_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profile_stats_t;
+
+typedef struct {
+    keyframe_animation_t* animation;
+    const char* name;
+    uint32_t budget;
+    uint32_t over_budget;
+    profile_stats_t stats;
+} animation_profile_t;
+
+typedef struct {
+    const char* name;
+    int frame;
+    uint32_t cycles;
+    systime_t time;
+} worst_frame_t;
+
+static animation_profile_t animation_profiles[VISUALIZER_PROFILER_MAX_ANIMATIONS];
+static unsigned num_animation_profiles = 0;
+static profile_stats_t section_stats[VISUALIZER_PROFILE_NUM_SECTIONS];
+static worst_frame_t worst_frames[VISUALIZER_PROFILER_WORST_FRAMES];
+
+static const char* section_names[VISUALIZER_PROFILE_NUM_SECTIONS] = {
+    [VISUALIZER_PROFILE_FLUSH] = "flush",
+    [VISUALIZER_PROFILE_BACKLIGHT] = "backlight",
+};
+
+#define CYCLES_TO_US(cycles) ((unsigned)((cycles) / PIT_TIMER_CYCLES_PER_US))
+
+static void add_sample(profile_stats_t* stats, uint32_t cycles) {
+    if (stats->calls == 0 || cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+    stats->calls++;
+    stats->total += cycles;
+}
+
+static animation_profile_t* find_profile(keyframe_animation_t* animation) {
+    for (unsigned i = 0; i < num_animation_profiles; i++) {
+        if (animation_profiles[i].animation == animation) {
+            return &animation_profiles[i];
+        }
+    }
+    if (num_animation_profiles == VISUALIZER_PROFILER_MAX_ANIMATIONS) {
+        return NULL;
+    }
+    animation_profile_t* profile = &animation_profiles[num_animation_profiles++];
+    profile->animation = animation;
+    profile->name = "unnamed";
+    return profile;
+}
+
+// The log is kept sorted, with the slowest frame first
+static void log_frame(const char* name, int frame, uint32_t cycles) {
+    int i = VISUALIZER_PROFILER_WORST_FRAMES - 1;
+    if (cycles <= worst_frames[i].cycles) {
+        return;
+    }
+    for (; i > 0 && worst_frames[i - 1].cycles < cycles; i--) {
+        worst_frames[i] = worst_frames[i - 1];
+    }
+    worst_frames[i].name = name;
+    worst_frames[i].frame = frame;
+    worst_frames[i].cycles = cycles;
+    worst_frames[i].time = chVTGetSystemTimeX();
+}
+
+void visualizer_profiler_register(keyframe_animation_t* animation, const char* name, uint32_t budget_us) {
+    chSysLock();
+    animation_profile_t* profile = find_profile(animation);
+    if (profile) {
+        profile->name = name;
+        profile->budget = budget_us * PIT_TIMER_CYCLES_PER_US;
+    }
+    chSysUnlock();
+}
+
+bool visualizer_profile_frame(frame_func func, keyframe_animation_t* animation, visualizer_state_t* state) {
+    uint32_t start = pit_timer_now();
+    bool ret = func(animation, state);
+    uint32_t cycles = pit_timer_now() - start;
+    chSysLock();
+    animation_profile_t* profile = find_profile(animation);
+    if (profile) {
+        add_sample(&profile->stats, cycles);
+        if (profile->budget && cycles > profile->budget) {
+            profile->over_budget++;
+        }
+        log_frame(profile->name, animation->current_frame, cycles);
+    }
+    chSysUnlock();
+#ifdef TELEMETRY_ENABLE
+    if (profile) {
+        telemetry_visualizer_frame(profile - animation_profiles, animation->current_frame, CYCLES_TO_US(cycles));
+    }
+#endif
+    return ret;
+}
+
+uint32_t visualizer_profile_begin(void) {
+    return pit_timer_now();
+}
+
+void visualizer_profile_end(visualizer_profile_section_t section, uint32_t start) {
+    uint32_t cycles = pit_timer_now() - start;
+    chSysLock();
+    add_sample(&section_stats[section], cycles);
+    chSysUnlock();
+#ifdef TELEMETRY_ENABLE
+    telemetry_visualizer_frame(TELEMETRY_SECTION_ID + section, 0, CYCLES_TO_US(cycles));
+#endif
+}
+
+#ifdef TELEMETRY_ENABLE
+const char* visualizer_profiler_name(unsigned id) {
+    if (id >= TELEMETRY_SECTION_ID) {
+        id -= TELEMETRY_SECTION_ID;
+        return id < VISUALIZER_PROFILE_NUM_SECTIONS ? section_names[id] : NULL;
+    }
+    chSysLock();
+    const char* name = id < num_animation_profiles ? animation_profiles[id].name : NULL;
+    chSysUnlock();
+    return name;
+}
+#endif
+
+void visualizer_profiler_reset(void) {
+    chSysLock();
+    for (unsigned i = 0; i < num_animation_profiles; i++) {
+        memset(&animation_profiles[i].stats, 0, sizeof(profile_stats_t));
+        animation_profiles[i].over_budget = 0;
+    }
+    memset(section_stats, 0, sizeof(section_stats));
+    memset(worst_frames, 0, sizeof(worst_frames));
+    chSysUnlock();
+}
+
+static void print_stats(const char* name, const profile_stats_t* stats) {
+    uint32_t avg = stats->calls ? stats->total / stats->calls : 0;
+    xprintf("%10s %6u %6u %6u %6u", name, (unsigned)stats->calls,
+        CYCLES_TO_US(stats->min), CYCLES_TO_US(avg), CYCLES_TO_US(stats->max));
+}
+
+void visualizer_profiler_print(void) {
+    // The printing is slow, so it's done from a copy
+    static animation_profile_t profiles[VISUALIZER_PROFILER_MAX_ANIMATIONS];
+    static profile_stats_t sections[VISUALIZER_PROFILE_NUM_SECTIONS];
+    static worst_frame_t worst[VISUALIZER_PROFILER_WORST_FRAMES];
+    chSysLock();
+    unsigned num_profiles = num_animation_profiles;
+    memcpy(profiles, animation_profiles, sizeof(profiles));
+    memcpy(sections, section_stats, sizeof(sections));
+    memcpy(worst, worst_frames, sizeof(worst));
+    chSysUnlock();
+
+    xprintf("\nVisualizer profile (us)\n");
+    xprintf("%10s %6s %6s %6s %6s %s\n", "", "calls", "min", "avg", "max", "over");
+    for (unsigned i = 0; i < num_profiles; i++) {
+        print_stats(profiles[i].name, &profiles[i].stats);
+        xprintf(" %u\n", (unsigned)profiles[i].over_budget);
+    }
+    for (int i = 0; i < VISUALIZER_PROFILE_NUM_SECTIONS; i++) {
+        print_stats(section_names[i], &sections[i]);
+        xprintf("\n");
+    }
+    xprintf("Worst frames:\n");
+    for (int i = 0; i < VISUALIZER_PROFILER_WORST_FRAMES && worst[i].cycles; i++) {
+        xprintf("%s:%d %u us at %u ms\n", worst[i].name, worst[i].frame,
+            CYCLES_TO_US(worst[i].cycles),
+            (unsigned)(worst[i].time / (CH_CFG_ST_FREQUENCY / 1000)));
+    }
+}
@@ -0,0 +1,80 @@
+/*
+Copyright 2016 Fred Sundvik <fsundvik@gmail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VISUALIZER_PROFILER_H_
+#define VISUALIZER_PROFILER_H_
+
+#include "ch.h"
+#include "visualizer.h"
+
+// Measures the time the visualizer thread spends in the keyframe functions,
+// the LCD flushes and the backlight updates. The time comes from the PIT
+// counter of pit_timer.h, since the cycle counter of the core stops while a
+// flush waits for the SPI in idle. The results are printed with the "I"
+// console command.
+
+#define VISUALIZER_PROFILER_MAX_ANIMATIONS 8
+#define VISUALIZER_PROFILER_WORST_FRAMES 8
+
+typedef enum {
+    VISUALIZER_PROFILE_FLUSH,
+    VISUALIZER_PROFILE_BACKLIGHT,
+    VISUALIZER_PROFILE_NUM_SECTIONS,
+} visualizer_profile_section_t;
+
+#ifdef VISUALIZER_PROFILER_ENABLE
+
+// Gives the animation a name in the output. A frame function call that takes
+// more than budget_us is counted as over the budget, 0 means no budget.
+void visualizer_profiler_register(keyframe_animation_t* animation, const char* name, uint32_t budget_us);
+// Calls a frame function, and records how long it took
+bool visualizer_profile_frame(frame_func func, keyframe_animation_t* animation, visualizer_state_t* state);
+uint32_t visualizer_profile_begin(void);
+void visualizer_profile_end(visualizer_profile_section_t section, uint32_t start);
+void visualizer_profiler_print(void);
+void visualizer_profiler_reset(void);
+#ifdef TELEMETRY_ENABLE
+// The name of a telemetry visualizer id, NULL if there's none
+const char* visualizer_profiler_name(unsigned id);
+#endif
+
+// The animations can't pass the frame function to the profiler, so each one
+// gets a small wrapper, defined with VISUALIZER_PROFILED_FRAME and used
+// through VISUALIZER_PROFILED
+#define VISUALIZER_PROFILED(func) profiled_##func
+#define VISUALIZER_PROFILED_FRAME(func)                                        \
+    static bool profiled_##func(keyframe_animation_t* animation,               \
+            visualizer_state_t* state) {                                       \
+        return visualizer_profile_frame(func, animation, state);               \
+    }
+
+#define VISUALIZER_PROFILE_SECTION(section, code) {                            \
+    uint32_t profile_start = visualizer_profile_begin();                       \
+    code;                                                                      \
+    visualizer_profile_end(section, profile_start);                            \
+}
+
+#else
+
+#define visualizer_profiler_register(animation, name, budget_us)
+#define VISUALIZER_PROFILED(func) func
+#define VISUALIZER_PROFILED_FRAME(func)
+#define VISUALIZER_PROFILE_SECTION(section, code) { code; }
+
+#endif
+
+#endif /* VISUALIZER_PROFILER_H_ */
@@ -27,9 +27,38 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #endif
 
 #include "visualizer.h"
+#include "lcd_backlight_pipeline.h"
+#include "visualizer_profiler.h"
+#include "typing_speed.h"
+#include "key_heatmap.h"
+#include "diagnostics.h"
+#include "drivers/gdisp/st7565ergodox/st7565ergodox.h"
 
 static const char* welcome_text[] = {"TMK", "Infinity Ergodox"};
 
+// Works like gdispDrawString, but uses the glyph cache of the LCD driver,
+// which is a lot faster when the same text is drawn over and over again
+static void draw_string(coord_t x, coord_t y, const char* str, font_t font, color_t color) {
+    st7565_draw_string_t params = {
+        .x = x,
+        .y = y,
+        .str = str,
+        .font = font,
+        .color = color,
+    };
+    gdispControl(GDISP_CONTROL_ST7565_DRAW_STRING, &params);
+}
+
+// The frame function that drew what the LCD is showing, for the ones that
+// only update the parts that have changed. The others leave it NULL.
+static frame_func lcd_owner = NULL;
+
+// Works like gdispFlush, but the time is included in the profile
+static void flush(void) {
+    VISUALIZER_PROFILE_SECTION(VISUALIZER_PROFILE_FLUSH, gdispFlush());
+    lcd_owner = NULL;
+}
+
 // Just an example how to write custom keyframe functions, we could have moved
 // all this into the init function
 bool display_welcome(keyframe_animation_t* animation, visualizer_state_t* state) {
@@ -39,10 +68,10 @@ bool display_welcome(keyframe_animation_t* animation, visualizer_state_t* state)
     gdispClear(White);
     // You can use static variables for things that can't be found in the animation
     // or state structs
-    gdispDrawString(0, 3, welcome_text[0], state->font_dejavusansbold12, Black);
-    gdispDrawString(0, 15, welcome_text[1], state->font_dejavusansbold12, Black);
+    draw_string(0, 3, welcome_text[0], state->font_dejavusansbold12, Black);
+    draw_string(0, 15, welcome_text[1], state->font_dejavusansbold12, Black);
     // Always remember to flush the display
-    gdispFlush();
+    flush();
     // you could set the backlight color as well, but we won't do it here, since
     // it's part of the following animation
     // lcd_backlight_color(hue, saturation, intensity);
@@ -50,7 +79,260 @@ bool display_welcome(keyframe_animation_t* animation, visualizer_state_t* state)
     return false;
 }
 
+// Displays the name of the current layer, the same way as
+// keyframe_display_layer_text, but with the cached glyphs
+bool display_layer_text(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    gdispClear(White);
+    draw_string(0, 10, state->layer_text, state->font_dejavusansbold12, Black);
+    flush();
+    return false;
+}
+
+// Writes the value with one decimal when decimals is set, and a unit after it
+static void format_number(uint16_t value, bool decimals, const char* unit, char* buffer) {
+    char digits[6];
+    int num_digits = 0;
+    do {
+        digits[num_digits++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0 || (decimals && num_digits < 2));
+    while (num_digits > 0) {
+        if (decimals && num_digits == 1) {
+            *buffer++ = '.';
+        }
+        *buffer++ = digits[--num_digits];
+    }
+    while (*unit) {
+        *buffer++ = *unit++;
+    }
+    *buffer = 0;
+}
+
+// Displays the typing speed. The speed is calculated here and not in the
+// keyboard thread, which only records the times of the key presses. The
+// lcd_animation shows it as several short frames, so that the numbers are
+// refreshed without polling, and the display is only redrawn when the shown
+// numbers change.
+bool display_typing_speed(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    static typing_speed_t shown_typing_speed;
+    typing_speed_t speed = typing_speed_get();
+    if (lcd_owner == display_typing_speed &&
+            speed.wpm == shown_typing_speed.wpm &&
+            speed.keys_per_second_x10 == shown_typing_speed.keys_per_second_x10) {
+        return false;
+    }
+    char buffer[16];
+    gdispClear(White);
+    format_number(speed.wpm, false, " WPM", buffer);
+    draw_string(0, 3, buffer, state->font_dejavusansbold12, Black);
+    format_number(speed.keys_per_second_x10, true, " keys/s", buffer);
+    draw_string(0, 17, buffer, state->font_dejavusansbold12, Black);
+    flush();
+    lcd_owner = display_typing_speed;
+    shown_typing_speed = speed;
+    return false;
+}
+
+// The rendered layer bitmaps are cached, since the lcd_animation keeps showing
+// the same few combinations over and over again
+#define LAYER_BITMAP_CACHE_SIZE 4
+
+typedef struct {
+    uint32_t default_layer;
+    uint32_t layer;
+    uint32_t last_used;
+    bool valid;
+    uint8_t frame[ST7565_FRAME_SIZE];
+} layer_bitmap_t;
+
+static layer_bitmap_t layer_bitmap_cache[LAYER_BITMAP_CACHE_SIZE];
+static uint32_t layer_bitmap_counter = 0;
+
+static void format_layer_bitmap_string(uint16_t default_layer, uint16_t layer, char* buffer) {
+    for (int i = 0; i < 16; i++) {
+        if (i > 0 && i % 4 == 0) {
+            *buffer++ = ' ';
+        }
+        bool is_default = (default_layer >> i) & 1;
+        bool is_active = (layer >> i) & 1;
+        if (is_default && is_active) {
+            *buffer++ = 'B';
+        }
+        else if (is_active) {
+            *buffer++ = '1';
+        }
+        else if (is_default) {
+            *buffer++ = 'D';
+        }
+        else {
+            *buffer++ = '0';
+        }
+    }
+    *buffer = 0;
+}
+
+static void draw_layer_bitmap(visualizer_state_t* state) {
+    const char* layer_help = "1=On D=Default B=Both";
+    char layer_buffer[16 + 4]; // 3 spaces and one null terminator
+    gdispClear(White);
+    draw_string(0, 0, layer_help, state->font_fixed5x8, Black);
+    format_layer_bitmap_string(state->status.default_layer, state->status.layer, layer_buffer);
+    draw_string(0, 10, layer_buffer, state->font_fixed5x8, Black);
+    format_layer_bitmap_string(state->status.default_layer >> 16, state->status.layer >> 16, layer_buffer);
+    draw_string(0, 20, layer_buffer, state->font_fixed5x8, Black);
+}
+
+// Works like keyframe_display_layer_bitmap, but the frame is only rendered the
+// first time each layer combination is shown. After that it's copied from the
+// cache, and if it's what the display is already showing, nothing is sent.
+bool display_layer_bitmap(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    layer_bitmap_t* entry = NULL;
+    layer_bitmap_t* oldest = &layer_bitmap_cache[0];
+    for (int i = 0; i < LAYER_BITMAP_CACHE_SIZE; i++) {
+        layer_bitmap_t* e = &layer_bitmap_cache[i];
+        if (e->valid && e->default_layer == state->status.default_layer &&
+                e->layer == state->status.layer) {
+            entry = e;
+            break;
+        }
+        if (!e->valid || (oldest->valid && e->last_used < oldest->last_used)) {
+            oldest = e;
+        }
+    }
+    if (entry) {
+        gdispControl(GDISP_CONTROL_ST7565_WRITE_FRAME, entry->frame);
+    }
+    else {
+        entry = oldest;
+        draw_layer_bitmap(state);
+        gdispControl(GDISP_CONTROL_ST7565_READ_FRAME, entry->frame);
+        entry->default_layer = state->status.default_layer;
+        entry->layer = state->status.layer;
+        entry->valid = true;
+    }
+    entry->last_used = ++layer_bitmap_counter;
+    flush();
+    return false;
+}
+
+// The heatmap has a cell for each key, with the matrix rows from left to right
+// and the columns from top to bottom. The right half starts after a small gap.
+#define HEATMAP_CELL_WIDTH 7
+#define HEATMAP_CELL_HEIGHT 6
+#define HEATMAP_HALF_GAP 2
+#define HEATMAP_LEVELS 5
+
+// Shows how much each key has been used, compared to the most used one, as a
+// square of one to five pixels. The keys that have never been pressed are
+// empty.
+bool display_key_heatmap(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    (void)state;
+    uint32_t max = 0;
+    for (int row = 0; row < MATRIX_ROWS; row++) {
+        for (int col = 0; col < MATRIX_COLS; col++) {
+            if (key_heatmap_counts[row][col] > max) {
+                max = key_heatmap_counts[row][col];
+            }
+        }
+    }
+    gdispClear(White);
+    for (int row = 0; row < MATRIX_ROWS; row++) {
+        coord_t x = row * HEATMAP_CELL_WIDTH;
+        if (row >= LOCAL_MATRIX_ROWS) {
+            x += HEATMAP_HALF_GAP;
+        }
+        for (int col = 0; col < MATRIX_COLS; col++) {
+            uint32_t count = key_heatmap_counts[row][col];
+            if (count == 0) {
+                continue;
+            }
+            coord_t size = ((uint64_t)count * HEATMAP_LEVELS + max - 1) / max;
+            coord_t y = 1 + col * HEATMAP_CELL_HEIGHT;
+            gdispFillArea(x + (HEATMAP_CELL_WIDTH - size) / 2,
+                y + (HEATMAP_CELL_HEIGHT - size) / 2, size, size, Black);
+        }
+    }
+    flush();
+    return false;
+}
+
+// The diagnostics graph has a strip for the scan rate, the key to report
+// latency and the link update gap, with the labels on the left. The bars are
+// on a logarithmic scale, each pixel doubles the value.
+#define GRAPH_X 24
+#define GRAPH_STRIP_HEIGHT 10
+#define GRAPH_STRIP_SPACING 11
+#define GRAPH_SCANS_PER_PIXEL 16
+#define GRAPH_US_PER_PIXEL 500
+
+static uint32_t graph_bar(unsigned strip, uint32_t value) {
+    unsigned height = 0;
+    while (value > 0 && height < GRAPH_STRIP_HEIGHT) {
+        height++;
+        value >>= 1;
+    }
+    unsigned bottom = strip * GRAPH_STRIP_SPACING + GRAPH_STRIP_HEIGHT;
+    return ((1u << height) - 1) << (bottom - height);
+}
+
+// Adds a column to the scrolling diagnostics graph, once per second. Only the
+// new column is drawn, the driver scrolls the rest.
+bool display_diagnostics(keyframe_animation_t* animation, visualizer_state_t* state) {
+    (void)animation;
+    diagnostics_sample_t sample = diagnostics_sample(DIAGNOSTICS_GRAPH);
+    if (lcd_owner != display_diagnostics) {
+        gdispClear(White);
+        draw_string(0, 1, "scan", state->font_fixed5x8, Black);
+        draw_string(0, 1 + GRAPH_STRIP_SPACING, "key", state->font_fixed5x8, Black);
+        draw_string(0, 1 + 2 * GRAPH_STRIP_SPACING, "link", state->font_fixed5x8, Black);
+    }
+    st7565_scroll_column_t column = {
+        .x = GRAPH_X,
+        .pixels = graph_bar(0, sample.scans_per_second / GRAPH_SCANS_PER_PIXEL) |
+            graph_bar(1, sample.max_latency_us / GRAPH_US_PER_PIXEL) |
+            graph_bar(2, sample.max_link_gap_us / GRAPH_US_PER_PIXEL),
+        .color = Black,
+    };
+    gdispControl(GDISP_CONTROL_ST7565_SCROLL_COLUMN, &column);
+    flush();
+    lcd_owner = display_diagnostics;
+    return false;
+}
+
+// Fades the backlight to the target color like keyframe_animate_backlight_color,
+// but the whole fade is precomputed and then run by the hardware, so the
+// visualizer doesn't have to wake up again until the end of the frame
+bool fade_backlight_color(keyframe_animation_t* animation, visualizer_state_t* state) {
+    VISUALIZER_PROFILE_SECTION(VISUALIZER_PROFILE_BACKLIGHT,
+        lcd_backlight_pipeline_fade(state->current_lcd_color, state->target_lcd_color,
+            animation->time_left_in_frame));
+    state->current_lcd_color = state->target_lcd_color;
+    return false;
+}
+
+// All the frame functions used by the animations are wrapped, so that they can be
+// profiled
+VISUALIZER_PROFILED_FRAME(display_welcome)
+VISUALIZER_PROFILED_FRAME(display_layer_text)
+VISUALIZER_PROFILED_FRAME(display_layer_bitmap)
+VISUALIZER_PROFILED_FRAME(display_typing_speed)
+VISUALIZER_PROFILED_FRAME(display_key_heatmap)
+VISUALIZER_PROFILED_FRAME(display_diagnostics)
+VISUALIZER_PROFILED_FRAME(fade_backlight_color)
+VISUALIZER_PROFILED_FRAME(keyframe_no_operation)
+VISUALIZER_PROFILED_FRAME(enable_visualization)
+VISUALIZER_PROFILED_FRAME(keyframe_disable_lcd_and_backlight)
+VISUALIZER_PROFILED_FRAME(keyframe_enable_lcd_and_backlight)
+
 // Feel free to modify the animations below, or even add new ones if needed
+// All the frame functions used here return false, so the visualizer thread only
+// wakes up when a frame changes. A frame function that returns true would be
+// called again after a short delay for as long as the frame lasts, so anything
+// that needs refreshing is split into several shorter frames instead
 
 // Don't worry, if the startup animation is long, you can use the keyboard like normal
 // during that time
@@ -59,10 +341,10 @@ static keyframe_animation_t startup_animation = {
     .loop = false,
     .frame_lengths = {0, MS2ST(1000), MS2ST(5000), 0},
     .frame_functions = {
-            display_welcome,
-            keyframe_animate_backlight_color,
-            keyframe_no_operation,
-            enable_visualization
+            VISUALIZER_PROFILED(display_welcome),
+            VISUALIZER_PROFILED(fade_backlight_color),
+            VISUALIZER_PROFILED(keyframe_no_operation),
+            VISUALIZER_PROFILED(enable_visualization)
     },
 };
 
@@ -74,16 +356,43 @@ static keyframe_animation_t color_animation = {
     // this prevents the color from changing when activating the layer
     // momentarily
     .frame_lengths = {MS2ST(200), MS2ST(500)},
-    .frame_functions = {keyframe_no_operation, keyframe_animate_backlight_color},
+    .frame_functions = {
+            VISUALIZER_PROFILED(keyframe_no_operation),
+            VISUALIZER_PROFILED(fade_backlight_color),
+    },
 };
 
-// The LCD animation alternates between the layer name display and a
-// bitmap that displays all active layers
+// The LCD animation cycles between the layer name display, a bitmap that
+// displays all active layers, the typing speed and the key heatmap. The typing
+// speed is shown for four 500 ms frames, so that it's updated twice a second
 static keyframe_animation_t lcd_animation = {
-    .num_frames = 2,
+    .num_frames = 7,
+    .loop = true,
+    .frame_lengths = {
+            MS2ST(2000), MS2ST(2000),
+            MS2ST(500), MS2ST(500), MS2ST(500), MS2ST(500),
+            MS2ST(2000),
+    },
+    .frame_functions = {
+            VISUALIZER_PROFILED(display_layer_text),
+            VISUALIZER_PROFILED(display_layer_bitmap),
+            VISUALIZER_PROFILED(display_typing_speed),
+            VISUALIZER_PROFILED(display_typing_speed),
+            VISUALIZER_PROFILED(display_typing_speed),
+            VISUALIZER_PROFILED(display_typing_speed),
+            VISUALIZER_PROFILED(display_key_heatmap),
+    },
+};
+
+// Replaces the LCD animation when the diagnostics graph is enabled with the
+// G console command
+static keyframe_animation_t diagnostics_animation = {
+    .num_frames = 1,
     .loop = true,
-    .frame_lengths = {MS2ST(2000), MS2ST(2000)},
-    .frame_functions = {keyframe_display_layer_text, keyframe_display_layer_bitmap},
+    .frame_lengths = {MS2ST(1000)},
+    .frame_functions = {
+            VISUALIZER_PROFILED(display_diagnostics),
+    },
 };
 
 static keyframe_animation_t suspend_animation = {
@@ -91,9 +400,9 @@ static keyframe_animation_t suspend_animation = {
     .loop = false,
     .frame_lengths = {0, MS2ST(1000), 0},
     .frame_functions = {
-            keyframe_display_layer_text,
-            keyframe_animate_backlight_color,
-            keyframe_disable_lcd_and_backlight,
+            VISUALIZER_PROFILED(display_layer_text),
+            VISUALIZER_PROFILED(fade_backlight_color),
+            VISUALIZER_PROFILED(keyframe_disable_lcd_and_backlight),
     },
 };
 
@@ -102,22 +411,39 @@ static keyframe_animation_t resume_animation = {
     .loop = false,
     .frame_lengths = {0, 0, MS2ST(1000), MS2ST(5000), 0},
     .frame_functions = {
-            keyframe_enable_lcd_and_backlight,
-            display_welcome,
-            keyframe_animate_backlight_color,
-            keyframe_no_operation,
-            enable_visualization,
+            VISUALIZER_PROFILED(keyframe_enable_lcd_and_backlight),
+            VISUALIZER_PROFILED(display_welcome),
+            VISUALIZER_PROFILED(fade_backlight_color),
+            VISUALIZER_PROFILED(keyframe_no_operation),
+            VISUALIZER_PROFILED(enable_visualization),
     },
 };
 void initialize_user_visualizer(visualizer_state_t* state) {
     // The brightness will be dynamically adjustable in the future
     // But for now, change it here.
     lcd_backlight_brightness(0x50);
+    lcd_backlight_pipeline_brightness(0x50);
+    // The budgets are the longest a single frame function call of the
+    // animation should take, in microseconds
+    visualizer_profiler_register(&startup_animation, "startup", 3000);
+    visualizer_profiler_register(&color_animation, "color", 1000);
+    visualizer_profiler_register(&lcd_animation, "lcd", 2000);
+    visualizer_profiler_register(&diagnostics_animation, "diagnostics", 2000);
+    visualizer_profiler_register(&suspend_animation, "suspend", 2000);
+    visualizer_profiler_register(&resume_animation, "resume", 3000);
     state->current_lcd_color = LCD_COLOR(0x00, 0x00, 0xFF);
     state->target_lcd_color = LCD_COLOR(0x10, 0xFF, 0xFF);
     start_keyframe_animation(&startup_animation);
 }
 
+// What update_user_visualizer_state last started the animations for. The
+// suspend and resume animations replace what's shown, so first_update is set
+// again by them, and everything is restarted on the next update
+static const char* prev_layer_text = NULL;
+static uint32_t prev_target_color = 0;
+static bool prev_graph_enabled = false;
+static bool first_update = true;
+
 void update_user_visualizer_state(visualizer_state_t* state) {
     // Add more tests, change the colors and layer texts here
     // Usually you want to check the high bits (higher layers first)
@@ -145,20 +471,42 @@ void update_user_visualizer_state(visualizer_state_t* state) {
     // You can also stop existing animations, and start your custom ones here
     // remember that you should normally have only one animation for the LCD
     // and one for the background. But you can also combine them if you want.
-    start_keyframe_animation(&lcd_animation);
-    start_keyframe_animation(&color_animation);
+    // The state is also updated when only the LEDs change, so the animations
+    // are restarted only when they would show something different
+    bool graph_enabled = diagnostics_graph_enabled();
+    if (graph_enabled) {
+        if (first_update || !prev_graph_enabled) {
+            stop_keyframe_animation(&lcd_animation);
+            start_keyframe_animation(&diagnostics_animation);
+        }
+    }
+    else if (first_update || prev_graph_enabled || state->layer_text != prev_layer_text) {
+        stop_keyframe_animation(&diagnostics_animation);
+        start_keyframe_animation(&lcd_animation);
+    }
+    if (first_update || state->target_lcd_color != prev_target_color) {
+        start_keyframe_animation(&color_animation);
+    }
+    first_update = false;
+    prev_graph_enabled = graph_enabled;
+    prev_layer_text = state->layer_text;
+    prev_target_color = state->target_lcd_color;
 }
 
 void user_visualizer_suspend(visualizer_state_t* state) {
+    lcd_backlight_hal_set_profile(LCD_BACKLIGHT_PROFILE_LOW_POWER);
     state->layer_text = "Suspending...";
     uint8_t hue = LCD_HUE(state->current_lcd_color);
     uint8_t sat = LCD_SAT(state->current_lcd_color);
     state->target_lcd_color = LCD_COLOR(hue, sat, 0);
     start_keyframe_animation(&suspend_animation);
+    first_update = true;
 }
 
 void user_visualizer_resume(visualizer_state_t* state) {
+    lcd_backlight_hal_set_profile(LCD_BACKLIGHT_PROFILE_NORMAL);
     state->current_lcd_color = LCD_COLOR(0x00, 0x00, 0x00);
     state->target_lcd_color = LCD_COLOR(0x10, 0xFF, 0xFF);
     start_keyframe_animation(&resume_animation);
+    first_update = true;
 }